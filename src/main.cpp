@@ -1,316 +1,6897 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_mixer.h>
+#include <SDL2/SDL_sound.h>
 #include <SDL2/SDL_ttf.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <format>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <poll.h>
 #include <random>
+#include <span>
+#include <spawn.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 void initialize_sdl();
+void require_sdl_image();
+void require_sdl_ttf();
+void require_sdl_mixer(int chunk_size);
+void require_sdl_sound();
+void require_sdl_gamecontroller();
 void close_sdl();
 
-class Game {
-  public:
-    Game();
-    ~Game();
+// Records wall time from process start to each startup stage, ending at the
+// first presented frame.
+class StartupTimer {
+  public:
+    StartupTimer();
+
+    void mark(const std::string &stage);
+    void report() const;
+    double total_ms() const;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point start;
+    std::vector<std::pair<std::string, Clock::time_point>> stages;
+};
+
+StartupTimer::StartupTimer() : start{Clock::now()} {}
+
+void StartupTimer::mark(const std::string &stage) {
+    this->stages.emplace_back(stage, Clock::now());
+}
+
+void StartupTimer::report() const {
+    auto prev = this->start;
+    for (const auto &[stage, time] : this->stages) {
+        std::chrono::duration<double, std::milli> delta = time - prev;
+        std::chrono::duration<double, std::milli> total = time - this->start;
+        std::cout << std::format("Startup {:<14} {:8.2f} ms {:8.2f} ms\n",
+                                 stage, delta.count(), total.count());
+        prev = time;
+    }
+}
+
+double StartupTimer::total_ms() const {
+    if (this->stages.empty()) {
+        return 0.0;
+    }
+    std::chrono::duration<double, std::milli> total =
+        this->stages.back().second - this->start;
+    return total.count();
+}
+
+StartupTimer startup_timer;
+
+// Kinds of SDL object whose memory is accounted for by ResourceRegistry.
+enum class Resource { Texture, Surface, Chunk, Font };
+
+constexpr std::array<const char *, 4> resource_names{"Textures", "Surfaces",
+                                                     "Chunks", "Fonts"};
+
+// Bytes held by live textures, surfaces, chunks and fonts, by kind. Objects
+// are added with track() where they are created and removed by the Handle
+// deleters below, so the totals follow ownership. Safe to use from the
+// loader threads. Texture sizes are the pixel data the driver was asked for.
+class ResourceRegistry {
+  public:
+    ResourceRegistry();
+
+    SDL_Texture *track(SDL_Texture *texture);
+    SDL_Surface *track(SDL_Surface *surf);
+    Mix_Chunk *track(Mix_Chunk *chunk);
+    TTF_Font *track(TTF_Font *font, std::size_t bytes);
+    void untrack(const void *ptr);
+
+    std::size_t bytes(Resource kind) const;
+    std::size_t count(Resource kind) const;
+    std::size_t total_bytes() const;
+    void report() const;
+
+  private:
+    struct Entry {
+        Resource kind;
+        std::size_t bytes;
+    };
+
+    void add(const void *ptr, Resource kind, std::size_t bytes);
+
+    mutable std::mutex mutex;
+    std::unordered_map<const void *, Entry> entries;
+    std::array<std::size_t, 4> kind_bytes;
+    std::array<std::size_t, 4> kind_count;
+    std::size_t peak_bytes;
+};
+
+ResourceRegistry::ResourceRegistry()
+    : mutex{}, entries{}, kind_bytes{}, kind_count{}, peak_bytes{0} {}
+
+SDL_Texture *ResourceRegistry::track(SDL_Texture *texture) {
+    Uint32 format;
+    int w, h;
+    if (texture && !SDL_QueryTexture(texture, &format, nullptr, &w, &h)) {
+        this->add(texture, Resource::Texture,
+                  static_cast<std::size_t>(w) * h * SDL_BYTESPERPIXEL(format));
+    }
+    return texture;
+}
+
+SDL_Surface *ResourceRegistry::track(SDL_Surface *surf) {
+    if (surf) {
+        this->add(surf, Resource::Surface,
+                  static_cast<std::size_t>(surf->pitch) * surf->h);
+    }
+    return surf;
+}
+
+Mix_Chunk *ResourceRegistry::track(Mix_Chunk *chunk) {
+    if (chunk) {
+        this->add(chunk, Resource::Chunk, chunk->alen);
+    }
+    return chunk;
+}
+
+TTF_Font *ResourceRegistry::track(TTF_Font *font, std::size_t bytes) {
+    if (font) {
+        this->add(font, Resource::Font, bytes);
+    }
+    return font;
+}
+
+void ResourceRegistry::add(const void *ptr, Resource kind, std::size_t bytes) {
+    std::lock_guard lock{this->mutex};
+    auto [it, inserted] = this->entries.try_emplace(ptr, Entry{kind, bytes});
+    if (!inserted) {
+        auto old = static_cast<std::size_t>(it->second.kind);
+        this->kind_bytes[old] -= it->second.bytes;
+        this->kind_count[old]--;
+        it->second = Entry{kind, bytes};
+    }
+    auto index = static_cast<std::size_t>(kind);
+    this->kind_bytes[index] += bytes;
+    this->kind_count[index]++;
+
+    std::size_t total = 0;
+    for (std::size_t kind_total : this->kind_bytes) {
+        total += kind_total;
+    }
+    this->peak_bytes = std::max(this->peak_bytes, total);
+}
+
+void ResourceRegistry::untrack(const void *ptr) {
+    std::lock_guard lock{this->mutex};
+    auto it = this->entries.find(ptr);
+    if (it == this->entries.end()) {
+        return;
+    }
+    auto index = static_cast<std::size_t>(it->second.kind);
+    this->kind_bytes[index] -= it->second.bytes;
+    this->kind_count[index]--;
+    this->entries.erase(it);
+}
+
+std::size_t ResourceRegistry::bytes(Resource kind) const {
+    std::lock_guard lock{this->mutex};
+    return this->kind_bytes[static_cast<std::size_t>(kind)];
+}
+
+std::size_t ResourceRegistry::count(Resource kind) const {
+    std::lock_guard lock{this->mutex};
+    return this->kind_count[static_cast<std::size_t>(kind)];
+}
+
+std::size_t ResourceRegistry::total_bytes() const {
+    std::lock_guard lock{this->mutex};
+    std::size_t total = 0;
+    for (std::size_t kind_total : this->kind_bytes) {
+        total += kind_total;
+    }
+    return total;
+}
+
+void ResourceRegistry::report() const {
+    std::lock_guard lock{this->mutex};
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < resource_names.size(); i++) {
+        std::cout << std::format("{:<14} live {:4} {:10.1f} KiB\n",
+                                 resource_names[i], this->kind_count[i],
+                                 this->kind_bytes[i] / 1024.0);
+        total += this->kind_bytes[i];
+    }
+    std::cout << std::format(
+        "Resources      total    {:10.1f} KiB peak {:.1f} KiB\n",
+        total / 1024.0, this->peak_bytes / 1024.0);
+}
+
+ResourceRegistry resources;
+
+// Resident set size of the process from /proc/self/statm.
+std::size_t current_rss_kb() {
+    std::ifstream statm{"/proc/self/statm"};
+    std::size_t size = 0;
+    std::size_t resident = 0;
+    statm >> size >> resident;
+    return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE)) / 1024;
+}
+
+void destroy_texture(SDL_Texture *texture) {
+    resources.untrack(texture);
+    SDL_DestroyTexture(texture);
+}
+
+void destroy_surface(SDL_Surface *surf) {
+    resources.untrack(surf);
+    SDL_FreeSurface(surf);
+}
+
+void destroy_font(TTF_Font *font) {
+    resources.untrack(font);
+    TTF_CloseFont(font);
+}
+
+void destroy_chunk(Mix_Chunk *chunk) {
+    resources.untrack(chunk);
+    Mix_FreeChunk(chunk);
+}
+
+// Owning handle whose destroy function is part of the type, so a handle is
+// the size of a raw pointer.
+template <auto Destroy> struct Deleter {
+    template <typename T> void operator()(T *ptr) const { Destroy(ptr); }
+};
+
+template <typename T, auto Destroy>
+using Handle = std::unique_ptr<T, Deleter<Destroy>>;
+
+using WindowPtr = Handle<SDL_Window, SDL_DestroyWindow>;
+using RendererPtr = Handle<SDL_Renderer, SDL_DestroyRenderer>;
+using TexturePtr = Handle<SDL_Texture, destroy_texture>;
+using SurfacePtr = Handle<SDL_Surface, destroy_surface>;
+using FontPtr = Handle<TTF_Font, destroy_font>;
+using ChunkPtr = Handle<Mix_Chunk, destroy_chunk>;
+using SamplePtr = Handle<Sound_Sample, Sound_FreeSample>;
+
+static_assert(sizeof(TexturePtr) == sizeof(SDL_Texture *));
+
+// Pixel kernels for ARGB8888 rows. The *_scalar versions are the reference
+// and the plain names pick AVX2, SSE2 or NEON at compile time, finishing
+// any tail with the scalar code. Both must give bit-identical results.
+
+// Divides by 255, rounding to nearest, for values up to 255 * 255.
+inline Uint32 div255(Uint32 x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Swaps the red and blue bytes, converting ARGB8888 <-> ABGR8888.
+void swizzle_rb_scalar(Uint32 *dst, const Uint32 *src, int count) {
+    for (int i = 0; i < count; i++) {
+        Uint32 p = src[i];
+        dst[i] = (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+    }
+}
+
+// Converts straight alpha to premultiplied alpha. dst may equal src.
+void premultiply_scalar(Uint32 *dst, const Uint32 *src, int count) {
+    for (int i = 0; i < count; i++) {
+        Uint32 p = src[i];
+        Uint32 a = p >> 24;
+        Uint32 r = div255(((p >> 16) & 0xff) * a);
+        Uint32 g = div255(((p >> 8) & 0xff) * a);
+        Uint32 b = div255((p & 0xff) * a);
+        dst[i] = (a << 24) | (r << 16) | (g << 8) | b;
+    }
+}
+
+// Composites premultiplied src over dst: dst = src + dst * (1 - src alpha).
+void blend_premultiplied_scalar(Uint32 *dst, const Uint32 *src, int count) {
+    for (int i = 0; i < count; i++) {
+        Uint32 s = src[i];
+        Uint32 d = dst[i];
+        Uint32 inv = 255 - (s >> 24);
+        Uint32 out = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            Uint32 c = div255(((d >> shift) & 0xff) * inv);
+            out |= (((s >> shift) & 0xff) + c) << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+#if defined(__AVX2__)
+inline __m256i div255_epi16(__m256i t) {
+    t = _mm256_add_epi16(t, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+inline __m256i alpha_epi16(__m256i px) {
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(px, 0xff), 0xff);
+}
+#elif defined(__SSE2__)
+inline __m128i div255_epi16(__m128i t) {
+    t = _mm_add_epi16(t, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+inline __m128i alpha_epi16(__m128i px) {
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(px, 0xff), 0xff);
+}
+#elif defined(__ARM_NEON)
+inline uint8x8_t div255_u16(uint16x8_t t) {
+    t = vaddq_u16(t, vdupq_n_u16(128));
+    return vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8);
+}
+#endif
+
+void swizzle_rb(Uint32 *dst, const Uint32 *src, int count) {
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i ag = _mm256_set1_epi32(static_cast<int>(0xff00ff00));
+    const __m256i lo = _mm256_set1_epi32(0xff);
+    for (; i + 8 <= count; i += 8) {
+        __m256i p =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 16), lo);
+        __m256i b = _mm256_slli_epi32(_mm256_and_si256(p, lo), 16);
+        p = _mm256_or_si256(_mm256_and_si256(p, ag), _mm256_or_si256(r, b));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), p);
+    }
+#elif defined(__SSE2__)
+    const __m128i ag = _mm_set1_epi32(static_cast<int>(0xff00ff00));
+    const __m128i lo = _mm_set1_epi32(0xff);
+    for (; i + 4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), lo);
+        __m128i b = _mm_slli_epi32(_mm_and_si128(p, lo), 16);
+        p = _mm_or_si128(_mm_and_si128(p, ag), _mm_or_si128(r, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), p);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t p = vld4_u8(reinterpret_cast<const uint8_t *>(src + i));
+        uint8x8_t tmp = p.val[0];
+        p.val[0] = p.val[2];
+        p.val[2] = tmp;
+        vst4_u8(reinterpret_cast<uint8_t *>(dst + i), p);
+    }
+#endif
+    swizzle_rb_scalar(dst + i, src + i, count - i);
+}
+
+void premultiply(Uint32 *dst, const Uint32 *src, int count) {
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xff000000));
+    for (; i + 8 <= count; i += 8) {
+        __m256i p =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i lo = _mm256_unpacklo_epi8(p, zero);
+        __m256i hi = _mm256_unpackhi_epi8(p, zero);
+        lo = div255_epi16(_mm256_mullo_epi16(lo, alpha_epi16(lo)));
+        hi = div255_epi16(_mm256_mullo_epi16(hi, alpha_epi16(hi)));
+        __m256i out = _mm256_packus_epi16(lo, hi);
+        out = _mm256_or_si256(_mm256_andnot_si256(alpha, out),
+                              _mm256_and_si256(alpha, p));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), out);
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+    for (; i + 4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i lo = _mm_unpacklo_epi8(p, zero);
+        __m128i hi = _mm_unpackhi_epi8(p, zero);
+        lo = div255_epi16(_mm_mullo_epi16(lo, alpha_epi16(lo)));
+        hi = div255_epi16(_mm_mullo_epi16(hi, alpha_epi16(hi)));
+        __m128i out = _mm_packus_epi16(lo, hi);
+        out = _mm_or_si128(_mm_andnot_si128(alpha, out),
+                           _mm_and_si128(alpha, p));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), out);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t p = vld4_u8(reinterpret_cast<const uint8_t *>(src + i));
+        for (int c = 0; c < 3; c++) {
+            p.val[c] = div255_u16(vmull_u8(p.val[c], p.val[3]));
+        }
+        vst4_u8(reinterpret_cast<uint8_t *>(dst + i), p);
+    }
+#endif
+    premultiply_scalar(dst + i, src + i, count - i);
+}
+
+void blend_premultiplied(Uint32 *dst, const Uint32 *src, int count) {
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i full = _mm256_set1_epi16(255);
+    for (; i + 8 <= count; i += 8) {
+        __m256i s =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i *>(dst + i));
+        __m256i inv_lo =
+            _mm256_sub_epi16(full, alpha_epi16(_mm256_unpacklo_epi8(s, zero)));
+        __m256i inv_hi =
+            _mm256_sub_epi16(full, alpha_epi16(_mm256_unpackhi_epi8(s, zero)));
+        __m256i lo = div255_epi16(
+            _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), inv_lo));
+        __m256i hi = div255_epi16(
+            _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), inv_hi));
+        __m256i out = _mm256_add_epi8(s, _mm256_packus_epi16(lo, hi));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), out);
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i *>(dst + i));
+        __m128i inv_lo =
+            _mm_sub_epi16(full, alpha_epi16(_mm_unpacklo_epi8(s, zero)));
+        __m128i inv_hi =
+            _mm_sub_epi16(full, alpha_epi16(_mm_unpackhi_epi8(s, zero)));
+        __m128i lo =
+            div255_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inv_lo));
+        __m128i hi =
+            div255_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inv_hi));
+        __m128i out = _mm_add_epi8(s, _mm_packus_epi16(lo, hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), out);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t *>(src + i));
+        uint8x8x4_t d = vld4_u8(reinterpret_cast<const uint8_t *>(dst + i));
+        uint8x8_t inv = vsub_u8(vdup_n_u8(255), s.val[3]);
+        for (int c = 0; c < 4; c++) {
+            d.val[c] = vadd_u8(s.val[c], div255_u16(vmull_u8(d.val[c], inv)));
+        }
+        vst4_u8(reinterpret_cast<uint8_t *>(dst + i), d);
+    }
+#endif
+    blend_premultiplied_scalar(dst + i, src + i, count - i);
+}
+
+// Copies a surface into ARGB8888 rows at dst, pitch given in pixels. A
+// colour-keyed surface always goes through SDL's conversion, which turns
+// the key into transparent pixels.
+void surface_to_argb(SDL_Surface *surf, Uint32 *dst, int dst_pitch) {
+    SurfacePtr converted{nullptr};
+    if (SDL_HasColorKey(surf) ||
+        (surf->format->format != SDL_PIXELFORMAT_ARGB8888 &&
+         surf->format->format != SDL_PIXELFORMAT_ABGR8888)) {
+        converted.reset(resources.track(
+            SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_ARGB8888, 0)));
+        if (!converted) {
+            auto error =
+                std::format("Error converting Surface: {}", SDL_GetError());
+            throw std::runtime_error(error);
+        }
+        surf = converted.get();
+    }
+
+    bool swap = surf->format->format == SDL_PIXELFORMAT_ABGR8888;
+    for (int y = 0; y < surf->h; y++) {
+        const auto *row = reinterpret_cast<const Uint32 *>(
+            static_cast<const Uint8 *>(surf->pixels) + y * surf->pitch);
+        if (swap) {
+            swizzle_rb(dst + y * dst_pitch, row, surf->w);
+        } else {
+            std::memcpy(dst + y * dst_pitch, row, surf->w * sizeof(Uint32));
+        }
+    }
+}
+
+struct PoolStats {
+    std::size_t created{0};
+    std::size_t reused{0};
+    std::size_t released{0};
+    std::size_t destroyed{0};
+};
+
+// Keeps released textures and hands them back out for the same renderer,
+// format, access and size instead of creating new ones.
+class TexturePool {
+  public:
+    TexturePool();
+    ~TexturePool();
+
+    TexturePtr acquire(SDL_Renderer *renderer, Uint32 format, int access,
+                       int w, int h);
+    TexturePtr from_surface(SDL_Renderer *renderer, SDL_Surface *surf);
+    void release(SDL_Renderer *renderer, TexturePtr texture);
+    void clear();
+
+    const PoolStats &stats() const { return this->counters; }
+
+  private:
+    using Key = std::tuple<SDL_Renderer *, Uint32, int, int, int>;
+
+    static constexpr std::size_t max_per_key{4};
+
+    std::map<Key, std::vector<TexturePtr>> free_list;
+    std::vector<Uint32> scratch;
+    PoolStats counters;
+};
+
+TexturePool::TexturePool() : free_list{}, scratch{}, counters{} {}
+
+TexturePool::~TexturePool() { this->clear(); }
+
+TexturePtr TexturePool::acquire(SDL_Renderer *renderer, Uint32 format,
+                                int access, int w, int h) {
+    auto it = this->free_list.find({renderer, format, access, w, h});
+    if (it != this->free_list.end() && !it->second.empty()) {
+        TexturePtr texture = std::move(it->second.back());
+        it->second.pop_back();
+        this->counters.reused++;
+        return texture;
+    }
+
+    TexturePtr texture{
+        resources.track(SDL_CreateTexture(renderer, format, access, w, h))};
+    if (!texture) {
+        auto error = std::format("Error creating Texture: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+    this->counters.created++;
+    return texture;
+}
+
+TexturePtr TexturePool::from_surface(SDL_Renderer *renderer,
+                                     SDL_Surface *surf) {
+    const void *pixels = surf->pixels;
+    int pitch = surf->pitch;
+    bool keyed = SDL_HasColorKey(surf);
+    if (keyed || surf->format->format != SDL_PIXELFORMAT_ARGB8888) {
+        this->scratch.resize(static_cast<std::size_t>(surf->w) * surf->h);
+        surface_to_argb(surf, this->scratch.data(), surf->w);
+        pixels = this->scratch.data();
+        pitch = surf->w * static_cast<int>(sizeof(Uint32));
+    }
+
+    TexturePtr texture =
+        this->acquire(renderer, SDL_PIXELFORMAT_ARGB8888,
+                      SDL_TEXTUREACCESS_STATIC, surf->w, surf->h);
+    if (SDL_UpdateTexture(texture.get(), nullptr, pixels, pitch)) {
+        auto error = std::format("Error updating Texture: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+    // Only surfaces with an alpha channel or a colour key need blending.
+    // The mode is set either way, since a pooled texture keeps the one it
+    // had before.
+    SDL_SetTextureBlendMode(texture.get(), surf->format->Amask || keyed
+                                               ? SDL_BLENDMODE_BLEND
+                                               : SDL_BLENDMODE_NONE);
+
+    return texture;
+}
+
+void TexturePool::release(SDL_Renderer *renderer, TexturePtr texture) {
+    if (!texture) {
+        return;
+    }
+
+    Uint32 format;
+    int access, w, h;
+    if (SDL_QueryTexture(texture.get(), &format, &access, &w, &h)) {
+        this->counters.destroyed++;
+        return;
+    }
+
+    auto &textures = this->free_list[{renderer, format, access, w, h}];
+    if (textures.size() >= max_per_key) {
+        this->counters.destroyed++;
+        return;
+    }
+    textures.push_back(std::move(texture));
+    this->counters.released++;
+}
+
+void TexturePool::clear() {
+    for (auto &[key, textures] : this->free_list) {
+        this->counters.destroyed += textures.size();
+    }
+    this->free_list.clear();
+}
+
+// Textures made from decoded surfaces, one per renderer and surface, so
+// each extra viewport uploads an image once rather than every frame.
+// Textures are made the first time a renderer asks for them. The surface
+// address is part of the key, so a surface must be forgotten before it is
+// freed, and a renderer before it is destroyed.
+class TextureCache {
+  public:
+    TextureCache();
+
+    SDL_Texture *get(SDL_Renderer *renderer, SDL_Surface *surf);
+    void forget(SDL_Surface *surf);
+    void forget(SDL_Renderer *renderer);
+
+    std::size_t uploads() const { return this->upload_count; }
+    std::size_t hits() const { return this->hit_count; }
+
+  private:
+    using Key = std::pair<SDL_Renderer *, SDL_Surface *>;
+
+    std::map<Key, TexturePtr> textures;
+    std::size_t upload_count;
+    std::size_t hit_count;
+};
+
+TextureCache::TextureCache() : textures{}, upload_count{0}, hit_count{0} {}
+
+SDL_Texture *TextureCache::get(SDL_Renderer *renderer, SDL_Surface *surf) {
+    auto [it, inserted] = this->textures.try_emplace({renderer, surf});
+    if (!inserted) {
+        this->hit_count++;
+        return it->second.get();
+    }
+
+    it->second.reset(
+        resources.track(SDL_CreateTextureFromSurface(renderer, surf)));
+    if (!it->second) {
+        this->textures.erase(it);
+        auto error = std::format("Error creating Texture: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+    this->upload_count++;
+    return it->second.get();
+}
+
+void TextureCache::forget(SDL_Surface *surf) {
+    std::erase_if(this->textures, [surf](const auto &entry) {
+        return entry.first.second == surf;
+    });
+}
+
+void TextureCache::forget(SDL_Renderer *renderer) {
+    std::erase_if(this->textures, [renderer](const auto &entry) {
+        return entry.first.first == renderer;
+    });
+}
+
+// An extra window showing the same scene as the game window, such as a
+// minimap or a view on a second monitor. The scene is drawn at the game's
+// resolution and SDL scales it to the window. Time spent drawing and
+// presenting is kept so the cost of each viewport can be reported.
+class Viewport {
+  public:
+    Viewport(const std::string &title, int w, int h, int logical_w,
+             int logical_h, bool hidden);
+
+    SDL_Renderer *renderer() const { return this->view_renderer.get(); }
+    Uint32 window_id() const { return SDL_GetWindowID(this->window.get()); }
+    void record(double ms);
+    double ms_per_frame() const;
+
+  private:
+    WindowPtr window;
+    RendererPtr view_renderer;
+    double total_ms;
+    std::size_t frames;
+};
+
+Viewport::Viewport(const std::string &title, int w, int h, int logical_w,
+                   int logical_h, bool hidden)
+    : window{nullptr}, view_renderer{nullptr}, total_ms{0.0}, frames{0} {
+    this->window.reset(SDL_CreateWindow(title.c_str(), SDL_WINDOWPOS_UNDEFINED,
+                                        SDL_WINDOWPOS_UNDEFINED, w, h,
+                                        hidden ? SDL_WINDOW_HIDDEN : 0));
+    if (!this->window) {
+        auto error = std::format("Error creating Window: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+
+    this->view_renderer.reset(SDL_CreateRenderer(this->window.get(), -1, 0));
+    if (!this->view_renderer) {
+        auto error = std::format("Error creating Renderer: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+    SDL_RenderSetLogicalSize(this->view_renderer.get(), logical_w, logical_h);
+}
+
+void Viewport::record(double ms) {
+    this->total_ms += ms;
+    this->frames++;
+}
+
+double Viewport::ms_per_frame() const {
+    return this->frames ? this->total_ms / this->frames : 0.0;
+}
+
+// Counts every allocation made through global operator new, so the game loop
+// can check that steady-state frames do not touch the heap.
+std::atomic<std::size_t> heap_allocation_count{0};
+
+void *operator new(std::size_t size) {
+    heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+// Bump allocator for data that only lives for one frame. Everything handed
+// out is released at once by reset(), so containers using it must not
+// outlive the frame. Requests that do not fit fall back to the heap.
+class FrameArena : public std::pmr::memory_resource {
+  public:
+    explicit FrameArena(std::size_t capacity);
+
+    void reset();
+
+    std::size_t allocations() const { return this->count; }
+    std::size_t bytes_used() const { return this->offset; }
+    std::size_t overflows() const { return this->overflow_count; }
+
+  private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void *ptr, std::size_t bytes,
+                       std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource &other) const
+        noexcept override;
+
+    std::unique_ptr<std::byte[]> buffer;
+    std::size_t capacity;
+    std::size_t offset;
+    std::size_t count;
+    std::size_t overflow_count;
+};
+
+FrameArena::FrameArena(std::size_t capacity)
+    : buffer{std::make_unique<std::byte[]>(capacity)}, capacity{capacity},
+      offset{0}, count{0}, overflow_count{0} {}
+
+void FrameArena::reset() {
+    this->offset = 0;
+    this->count = 0;
+}
+
+void *FrameArena::do_allocate(std::size_t bytes, std::size_t alignment) {
+    this->count++;
+
+    std::size_t start = (this->offset + alignment - 1) & ~(alignment - 1);
+    if (start + bytes > this->capacity) {
+        this->overflow_count++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    this->offset = start + bytes;
+    return this->buffer.get() + start;
+}
+
+void FrameArena::do_deallocate(void *ptr, std::size_t bytes,
+                               std::size_t alignment) {
+    auto *byte_ptr = static_cast<std::byte *>(ptr);
+    if (byte_ptr >= this->buffer.get() &&
+        byte_ptr < this->buffer.get() + this->capacity) {
+        return;
+    }
+    std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+}
+
+bool FrameArena::do_is_equal(
+    const std::pmr::memory_resource &other) const noexcept {
+    return this == &other;
+}
+
+// Per-frame allocation figures gathered by Game::run. The first frames are
+// treated as warm-up and left out of the steady-state heap figures.
+struct FrameAllocStats {
+    static constexpr std::size_t warmup_frames{60};
+
+    std::size_t frames{0};
+    std::size_t max_arena_allocations{0};
+    std::size_t peak_arena_bytes{0};
+    std::size_t heap_allocations{0};
+    std::size_t max_heap_allocations{0};
+
+    void record(const FrameArena &arena, std::size_t heap);
+};
+
+void FrameAllocStats::record(const FrameArena &arena, std::size_t heap) {
+    this->frames++;
+    this->max_arena_allocations =
+        std::max(this->max_arena_allocations, arena.allocations());
+    this->peak_arena_bytes =
+        std::max(this->peak_arena_bytes, arena.bytes_used());
+    if (this->frames > warmup_frames) {
+        this->heap_allocations += heap;
+        this->max_heap_allocations = std::max(this->max_heap_allocations, heap);
+    }
+}
+
+void print_pool_stats(const std::string &name, const PoolStats &stats) {
+    std::cout << std::format("{:<14} created {:6} reused {:6} released {:6} "
+                             "destroyed {:6}\n",
+                             name, stats.created, stats.reused, stats.released,
+                             stats.destroyed);
+}
+
+// Lock-free single-producer single-consumer ring buffer. Capacity must be a
+// power of two. One thread may only call write(), the other only read().
+template <typename T> class SpscRing {
+  public:
+    explicit SpscRing(std::size_t capacity);
+
+    std::size_t write(const T *data, std::size_t count);
+    std::size_t read(T *data, std::size_t count);
+    std::size_t size() const;
+    std::size_t free_space() const;
+    void clear();
+
+  private:
+    std::unique_ptr<T[]> buffer;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+};
+
+template <typename T>
+SpscRing<T>::SpscRing(std::size_t capacity)
+    : buffer{std::make_unique<T[]>(capacity)}, mask{capacity - 1}, head{0},
+      tail{0} {}
+
+template <typename T>
+std::size_t SpscRing<T>::write(const T *data, std::size_t count) {
+    std::size_t t = this->tail.load(std::memory_order_relaxed);
+    std::size_t h = this->head.load(std::memory_order_acquire);
+    count = std::min(count, this->mask + 1 - (t - h));
+    for (std::size_t i = 0; i < count; i++) {
+        this->buffer[(t + i) & this->mask] = data[i];
+    }
+    this->tail.store(t + count, std::memory_order_release);
+    return count;
+}
+
+template <typename T>
+std::size_t SpscRing<T>::read(T *data, std::size_t count) {
+    std::size_t h = this->head.load(std::memory_order_relaxed);
+    std::size_t t = this->tail.load(std::memory_order_acquire);
+    count = std::min(count, t - h);
+    for (std::size_t i = 0; i < count; i++) {
+        data[i] = this->buffer[(h + i) & this->mask];
+    }
+    this->head.store(h + count, std::memory_order_release);
+    return count;
+}
+
+template <typename T> std::size_t SpscRing<T>::size() const {
+    return this->tail.load(std::memory_order_acquire) -
+           this->head.load(std::memory_order_acquire);
+}
+
+template <typename T> std::size_t SpscRing<T>::free_space() const {
+    return this->mask + 1 - this->size();
+}
+
+// Only safe while neither side is running.
+template <typename T> void SpscRing<T>::clear() {
+    this->head.store(0);
+    this->tail.store(0);
+}
+
+// Plays music decoded incrementally on a worker thread. SDL_sound decodes
+// the file a block at a time, already converted to the device format, and
+// the worker keeps a ring of samples filled ahead of the audio callback.
+// It wraps at the loop points without a gap and mixes crossfades itself,
+// so resident PCM is bounded by the ring and one block per track. The
+// callback only copies out of the ring.
+class MusicStream {
+  public:
+    MusicStream();
+    ~MusicStream();
+
+    void play(const std::string &path, std::size_t loop_start = 0,
+              std::size_t loop_end = 0);
+    void crossfade_to(const std::string &path, int fade_ms);
+    void seek(double seconds);
+    void stop();
+
+    void set_paused(bool paused);
+    bool paused() const { return this->is_paused.load(); }
+    std::size_t underruns() const { return this->underrun_count.load(); }
+    double position() const;
+
+  private:
+    // pos is the frame the next decoded sample belongs to. decoded points
+    // at the frames SDL_sound has decoded and not yet been copied out, and
+    // skip counts frames to drop after a seek, which SDL_sound only does
+    // to the millisecond.
+    struct Track {
+        SamplePtr sample;
+        std::size_t pos;
+        std::size_t loop_start;
+        std::size_t loop_end;
+        const Sint16 *decoded;
+        std::size_t available;
+        std::size_t skip;
+    };
+
+    static constexpr std::size_t block_frames{1024};
+
+    static void callback(void *udata, Uint8 *stream, int len);
+
+    Track open_track(const std::string &path, std::size_t loop_start,
+                     std::size_t loop_end) const;
+    void seek_track(Track &track, std::size_t frame) const;
+    void read_track(Track &track, Sint16 *out);
+
+    void produce(std::stop_token stop);
+    void fill_block(Sint16 *out);
+
+    int channels;
+    int frequency;
+    SpscRing<Sint16> ring;
+    std::atomic<bool> is_paused;
+    std::atomic<std::size_t> underrun_count;
+    std::atomic<std::size_t> played_frames;
+    std::atomic<Sint64> seek_frame;
+    std::mutex pending_mutex;
+    std::string pending;
+    int pending_fade_ms;
+    Track current;
+    Track next;
+    std::size_t fade_pos;
+    std::size_t fade_len;
+    std::vector<Sint16> block;
+    std::vector<Sint16> fade_block;
+    std::jthread worker;
+};
+
+MusicStream::MusicStream()
+    : channels{MIX_DEFAULT_CHANNELS}, frequency{MIX_DEFAULT_FREQUENCY},
+      ring{1 << 15}, is_paused{false}, underrun_count{0}, played_frames{0},
+      seek_frame{-1},
+      pending_mutex{}, pending{}, pending_fade_ms{0}, current{},
+      next{}, fade_pos{0}, fade_len{0}, block{}, fade_block{}, worker{} {}
+
+MusicStream::~MusicStream() { this->stop(); }
+
+void MusicStream::play(const std::string &path, std::size_t loop_start,
+                       std::size_t loop_end) {
+    this->stop();
+    require_sdl_sound();
+
+    Uint16 format;
+    if (!Mix_QuerySpec(&this->frequency, &format, &this->channels)) {
+        auto error = std::format("Error querying Audio: {}", Mix_GetError());
+        throw std::runtime_error(error);
+    }
+    if (format != AUDIO_S16SYS) {
+        throw std::runtime_error("Error playing Music: audio is not S16");
+    }
+
+    this->block.resize(block_frames * this->channels);
+    this->fade_block.resize(block_frames * this->channels);
+    this->underrun_count = 0;
+    this->played_frames = 0;
+
+    this->worker = std::jthread([this, path, loop_start,
+                                 loop_end](std::stop_token stop) {
+        try {
+            this->current = this->open_track(path, loop_start, loop_end);
+        } catch (const std::runtime_error &e) {
+            std::cerr << e.what() << std::endl;
+            return;
+        }
+
+        // Prefill before hooking in so startup is not counted as underruns.
+        while (this->ring.free_space() >= this->block.size()) {
+            this->fill_block(this->block.data());
+            this->ring.write(this->block.data(), this->block.size());
+        }
+        if (!stop.stop_requested()) {
+            Mix_HookMusic(callback, this);
+        }
+        this->produce(stop);
+    });
+}
+
+// The new track is opened on the worker thread before its next block.
+void MusicStream::crossfade_to(const std::string &path, int fade_ms) {
+    std::lock_guard lock{this->pending_mutex};
+    this->pending = path;
+    this->pending_fade_ms = fade_ms;
+}
+
+void MusicStream::stop() {
+    if (this->worker.joinable()) {
+        this->worker.request_stop();
+        this->worker.join();
+    }
+    Mix_HookMusic(nullptr, nullptr);
+    this->ring.clear();
+    this->current = {};
+    this->next = {};
+}
+
+void MusicStream::set_paused(bool paused) { this->is_paused = paused; }
+
+// Takes effect on the worker thread before its next block, so the audio
+// already queued in the ring still plays first.
+void MusicStream::seek(double seconds) {
+    this->seek_frame = static_cast<Sint64>(std::max(0.0, seconds) *
+                                           this->frequency);
+}
+
+double MusicStream::position() const {
+    return static_cast<double>(this->played_frames.load()) / this->frequency;
+}
+
+MusicStream::Track MusicStream::open_track(const std::string &path,
+                                           std::size_t loop_start,
+                                           std::size_t loop_end) const {
+    Sound_AudioInfo desired{AUDIO_S16SYS, static_cast<Uint8>(this->channels),
+                            static_cast<Uint32>(this->frequency)};
+    auto buffer_size = static_cast<Uint32>(block_frames * this->channels *
+                                           sizeof(Sint16));
+    SamplePtr sample{
+        Sound_NewSampleFromFile(path.c_str(), &desired, buffer_size)};
+    if (!sample) {
+        auto error = std::format("Error loading Music {}: {}", path,
+                                 Sound_GetError());
+        throw std::runtime_error(error);
+    }
+
+    // Without a loop end the track loops when the decoder reaches its end.
+    Track track{};
+    track.sample = std::move(sample);
+    track.loop_end =
+        loop_end ? loop_end : std::numeric_limits<std::size_t>::max();
+    track.loop_start = loop_start < track.loop_end ? loop_start : 0;
+    return track;
+}
+
+void MusicStream::seek_track(Track &track, std::size_t frame) const {
+    auto ms = static_cast<Uint32>(static_cast<Uint64>(frame) * 1000 /
+                                  this->frequency);
+    if (!Sound_Seek(track.sample.get(), ms)) {
+        Sound_Rewind(track.sample.get());
+        ms = 0;
+    }
+    track.pos = static_cast<std::size_t>(static_cast<Uint64>(ms) *
+                                         this->frequency / 1000);
+    track.skip = frame - std::min(frame, track.pos);
+    track.available = 0;
+}
+
+// Decodes just enough of the track to fill one block, going back to the
+// loop start whenever the loop end or the end of the file is reached.
+void MusicStream::read_track(Track &track, Sint16 *out) {
+    std::size_t filled = 0;
+    while (filled < block_frames) {
+        if (track.pos >= track.loop_end) {
+            this->seek_track(track, track.loop_start);
+            continue;
+        }
+        if (track.available == 0) {
+            Uint32 bytes = Sound_Decode(track.sample.get());
+            if (bytes == 0) {
+                // A loop that decodes nothing would never fill the block.
+                if (track.pos <= track.loop_start) {
+                    std::fill(out + filled * this->channels,
+                              out + block_frames * this->channels, 0);
+                    return;
+                }
+                this->seek_track(track, track.loop_start);
+                continue;
+            }
+            track.decoded = static_cast<const Sint16 *>(track.sample->buffer);
+            track.available = bytes / sizeof(Sint16) / this->channels;
+        }
+
+        std::size_t frames = std::min(track.available,
+                                      track.loop_end - track.pos);
+        if (track.skip) {
+            frames = std::min(frames, track.skip);
+            track.skip -= frames;
+        } else {
+            frames = std::min(frames, block_frames - filled);
+            std::copy_n(track.decoded, frames * this->channels,
+                        out + filled * this->channels);
+            filled += frames;
+        }
+        track.decoded += frames * this->channels;
+        track.available -= frames;
+        track.pos += frames;
+    }
+}
+
+void MusicStream::produce(std::stop_token stop) {
+    while (!stop.stop_requested()) {
+        {
+            std::lock_guard lock{this->pending_mutex};
+            if (!this->pending.empty() && !this->next.sample) {
+                try {
+                    this->next = this->open_track(this->pending, 0, 0);
+                    // In 64 bits, since ms * Hz overflows int for fades
+                    // of under a minute.
+                    this->fade_len = static_cast<std::size_t>(
+                        std::max<Sint64>(0, this->pending_fade_ms) *
+                        this->frequency / 1000);
+                    this->fade_pos = 0;
+                } catch (const std::runtime_error &e) {
+                    std::cerr << e.what() << std::endl;
+                }
+                this->pending.clear();
+            }
+        }
+
+        Sint64 seek_to = this->seek_frame.exchange(-1);
+        if (seek_to >= 0) {
+            Track &track = this->current;
+            auto frame = static_cast<std::size_t>(seek_to);
+            if (frame >= track.loop_end && track.loop_end > track.loop_start) {
+                frame = track.loop_start + (frame - track.loop_start) %
+                                               (track.loop_end -
+                                                track.loop_start);
+            }
+            this->seek_track(track, frame);
+            this->played_frames = static_cast<std::size_t>(seek_to);
+        }
+
+        if (this->ring.free_space() < this->block.size()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            continue;
+        }
+
+        this->fill_block(this->block.data());
+        this->ring.write(this->block.data(), this->block.size());
+    }
+}
+
+void MusicStream::fill_block(Sint16 *out) {
+    this->read_track(this->current, out);
+    if (!this->next.sample) {
+        return;
+    }
+
+    // Past the end of the fade t stays at 1, so the rest of the block is
+    // already the new track alone.
+    const Sint16 *nxt = this->fade_block.data();
+    this->read_track(this->next, this->fade_block.data());
+    for (std::size_t f = 0; f < block_frames; f++) {
+        float t = this->fade_pos < this->fade_len
+                      ? static_cast<float>(this->fade_pos) / this->fade_len
+                      : 1.0f;
+        for (int c = 0; c < this->channels; c++) {
+            std::size_t i = f * this->channels + c;
+            out[i] = static_cast<Sint16>(out[i] * (1.0f - t) + nxt[i] * t);
+        }
+        this->fade_pos++;
+    }
+
+    if (this->fade_pos >= this->fade_len) {
+        this->current = std::move(this->next);
+        this->next = {};
+    }
+}
+
+void MusicStream::callback(void *udata, Uint8 *stream, int len) {
+    auto *self = static_cast<MusicStream *>(udata);
+    auto *out = reinterpret_cast<Sint16 *>(stream);
+    std::size_t wanted = len / sizeof(Sint16);
+
+    if (self->is_paused.load(std::memory_order_relaxed)) {
+        std::memset(stream, 0, len);
+        return;
+    }
+
+    std::size_t got = self->ring.read(out, wanted);
+    if (got < wanted) {
+        std::memset(out + got, 0, (wanted - got) * sizeof(Sint16));
+        self->underrun_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    self->played_frames.fetch_add(got / self->channels,
+                                  std::memory_order_relaxed);
+}
+
+// Left and right gains for one voice.
+struct StereoGain {
+    float left;
+    float right;
+};
+
+// Places a sound relative to the listener. The horizontal offset across
+// the screen width pans it with a constant-power law, so it is as loud in
+// the middle as at either side, and its gain falls off linearly to a
+// quarter at the far corner of the screen.
+StereoGain spatialize(SDL_FPoint source, SDL_FPoint listener, float width,
+                      float height) {
+    constexpr float quarter_pi{0.785398163f};
+    float dx = source.x - listener.x;
+    float dy = source.y - listener.y;
+    float pan = std::clamp(dx / std::max(1.0f, width), -1.0f, 1.0f);
+    float distance = std::sqrt(dx * dx + dy * dy) /
+                     std::max(1.0f, std::hypot(width, height));
+    float gain = 1.0f - 0.75f * std::min(distance, 1.0f);
+    float angle = (pan + 1.0f) * quarter_pi;
+    return {std::max(0.0f, std::cos(angle)) * gain,
+            std::max(0.0f, std::sin(angle)) * gain};
+}
+
+// Sound effects mixed by the game in SDL_mixer's post-mix hook instead of
+// on its channels. Mix_PlayChannel takes the audio lock, so a sound started
+// while the callback runs stalls the frame. Here the game thread only
+// pushes commands into a lock-free ring and the callback applies them at
+// the start of each buffer. Voices are fixed slots, so the callback never
+// allocates. Each voice has its own left and right gain. Voices are summed
+// into a float bus a block at a time in loops the compiler vectorizes, and
+// the bus is saturated into the stream once. A chunk that may still be
+// playing is handed to retire() and freed once the callback has seen the
+// command forgetting it.
+class SoundMixer {
+  public:
+    SoundMixer();
+    ~SoundMixer();
+
+    void start();
+    void stop();
+    bool play(const Mix_Chunk *chunk, StereoGain gain = {1.0f, 1.0f});
+    void retire(ChunkPtr chunk);
+    void mix(Sint16 *out, std::size_t frames);
+
+    int playing() const { return this->active_voices.load(); }
+    std::size_t dropped() const { return this->dropped_count; }
+
+  private:
+    enum class Command : Uint8 { Play, Forget };
+
+    struct Message {
+        Command command;
+        const Mix_Chunk *chunk;
+        StereoGain gain;
+    };
+
+    struct Voice {
+        const Sint16 *samples;
+        std::size_t frames;
+        std::size_t pos;
+        StereoGain gain;
+        const Mix_Chunk *chunk;
+    };
+
+    static constexpr std::size_t max_voices{512};
+    static constexpr std::size_t block_frames{512};
+    static constexpr int max_channels{8};
+
+    static void callback(void *udata, Uint8 *stream, int len);
+
+    bool send(const Message &message);
+    void collect();
+    void apply(const Message &message);
+    void mix_voice(Voice &voice, std::size_t frames);
+
+    int channels;
+    bool hooked;
+    SpscRing<Message> commands;
+    std::size_t sent;
+    std::atomic<std::size_t> applied;
+    std::vector<std::pair<std::size_t, ChunkPtr>> retired;
+    std::size_t dropped_count;
+    std::vector<Voice> voices;
+    std::size_t voice_count;
+    std::vector<float> bus;
+    std::atomic<int> active_voices;
+};
+
+SoundMixer::SoundMixer()
+    : channels{MIX_DEFAULT_CHANNELS}, hooked{false}, commands{1024}, sent{0},
+      applied{0}, retired{}, dropped_count{0}, voices(max_voices),
+      voice_count{0}, bus(block_frames * max_channels), active_voices{0} {}
+
+SoundMixer::~SoundMixer() { this->stop(); }
+
+void SoundMixer::start() {
+    int frequency;
+    Uint16 format;
+    if (!Mix_QuerySpec(&frequency, &format, &this->channels)) {
+        auto error = std::format("Error querying Audio: {}", Mix_GetError());
+        throw std::runtime_error(error);
+    }
+    if (format != AUDIO_S16SYS || this->channels > max_channels) {
+        throw std::runtime_error("Error mixing Sounds: unsupported format");
+    }
+    Mix_SetPostMix(callback, this);
+    this->hooked = true;
+}
+
+// Unhooking waits for a running callback, so afterwards every chunk can
+// be freed.
+void SoundMixer::stop() {
+    if (this->hooked) {
+        Mix_SetPostMix(nullptr, nullptr);
+        this->hooked = false;
+    }
+    this->retired.clear();
+}
+
+// Returns false, dropping the sound, when the ring is full.
+bool SoundMixer::play(const Mix_Chunk *chunk, StereoGain gain) {
+    return this->send({Command::Play, chunk, gain});
+}
+
+void SoundMixer::retire(ChunkPtr chunk) {
+    if (!chunk || !this->hooked) {
+        return;
+    }
+    // The forget command is retried until the ring has room, since the
+    // chunk cannot be freed without it.
+    while (!this->send({Command::Forget, chunk.get(), {0.0f, 0.0f}})) {
+        std::this_thread::yield();
+    }
+    this->retired.emplace_back(this->sent, std::move(chunk));
+}
+
+bool SoundMixer::send(const Message &message) {
+    this->collect();
+    if (this->commands.write(&message, 1) == 0) {
+        this->dropped_count++;
+        return false;
+    }
+    this->sent++;
+    return true;
+}
+
+void SoundMixer::collect() {
+    std::size_t done = this->applied.load(std::memory_order_acquire);
+    std::erase_if(this->retired,
+                  [done](const auto &entry) { return entry.first <= done; });
+}
+
+// Runs on the audio thread.
+void SoundMixer::apply(const Message &message) {
+    if (message.command == Command::Forget) {
+        for (std::size_t i = 0; i < this->voice_count;) {
+            if (this->voices[i].chunk == message.chunk) {
+                this->voices[i] = this->voices[--this->voice_count];
+            } else {
+                i++;
+            }
+        }
+    } else if (this->voice_count < max_voices && message.chunk &&
+               message.chunk->alen) {
+        this->voices[this->voice_count++] = {
+            reinterpret_cast<const Sint16 *>(message.chunk->abuf),
+            message.chunk->alen / sizeof(Sint16) / this->channels, 0,
+            message.gain, message.chunk};
+    }
+}
+
+void SoundMixer::callback(void *udata, Uint8 *stream, int len) {
+    auto *self = static_cast<SoundMixer *>(udata);
+    self->mix(reinterpret_cast<Sint16 *>(stream),
+              len / sizeof(Sint16) / self->channels);
+}
+
+// Runs on the audio thread, or on whichever single thread drives the mixer
+// when it is not hooked in.
+void SoundMixer::mix(Sint16 *out, std::size_t frames) {
+    Message message;
+    while (this->commands.read(&message, 1)) {
+        this->apply(message);
+        this->applied.fetch_add(1, std::memory_order_release);
+    }
+
+    for (std::size_t done = 0; done < frames; done += block_frames) {
+        std::size_t count = std::min(block_frames, frames - done);
+        std::size_t samples = count * this->channels;
+        std::fill_n(this->bus.data(), samples, 0.0f);
+
+        for (std::size_t v = 0; v < this->voice_count;) {
+            Voice &voice = this->voices[v];
+            this->mix_voice(voice, count);
+            if (voice.pos >= voice.frames) {
+                voice = this->voices[--this->voice_count];
+            } else {
+                v++;
+            }
+        }
+
+        Sint16 *block = out + done * this->channels;
+        const float *sum = this->bus.data();
+        for (std::size_t i = 0; i < samples; i++) {
+            float mixed = block[i] + sum[i];
+            block[i] = static_cast<Sint16>(
+                std::clamp(mixed, -32768.0f, 32767.0f));
+        }
+    }
+    this->active_voices.store(static_cast<int>(this->voice_count),
+                              std::memory_order_relaxed);
+}
+
+// Stereo takes the two gains in turn. Mono gets their average and wider
+// layouts pan their odd channels right.
+void SoundMixer::mix_voice(Voice &voice, std::size_t frames) {
+    std::size_t count = std::min(frames, voice.frames - voice.pos);
+    const Sint16 *__restrict in = voice.samples + voice.pos * this->channels;
+    float *__restrict sum = this->bus.data();
+    float left = voice.gain.left;
+    float right = voice.gain.right;
+
+    if (this->channels == 2) {
+        for (std::size_t f = 0; f < count; f++) {
+            sum[2 * f] += in[2 * f] * left;
+            sum[2 * f + 1] += in[2 * f + 1] * right;
+        }
+    } else if (this->channels == 1) {
+        float gain = (left + right) * 0.5f;
+        for (std::size_t f = 0; f < count; f++) {
+            sum[f] += in[f] * gain;
+        }
+    } else {
+        for (std::size_t i = 0; i < count * this->channels; i++) {
+            sum[i] += in[i] * (i % this->channels % 2 ? right : left);
+        }
+    }
+    voice.pos += count;
+}
+
+// Time the game thread spends inside audio calls. On SDL_mixer's channels
+// this is mostly waiting for the audio lock while the callback runs.
+struct AudioCallStats {
+    std::size_t calls{0};
+    double total_us{0.0};
+    double max_us{0.0};
+
+    void add(double us);
+};
+
+void AudioCallStats::add(double us) {
+    this->calls++;
+    this->total_us += us;
+    this->max_us = std::max(this->max_us, us);
+}
+
+// An asset that changed on disk, already decoded by the watcher thread.
+// Only the member matching the file type is set.
+struct ReloadedAsset {
+    std::string path;
+    SurfacePtr surface;
+    ChunkPtr chunk;
+    std::vector<char> bytes;
+};
+
+// Watches asset directories with inotify on a background thread. Changed
+// files are decoded on that thread and handed to the game loop through
+// take(), which never waits on the watcher.
+class AssetWatcher {
+  public:
+    AssetWatcher();
+    ~AssetWatcher();
+
+    void start(const std::vector<std::string> &dirs);
+    std::vector<ReloadedAsset> take();
+
+  private:
+    void watch(std::stop_token stop);
+    void decode(const std::string &path);
+
+    int fd;
+    std::map<int, std::string> watch_dirs;
+    std::mutex ready_mutex;
+    std::vector<ReloadedAsset> ready;
+    std::jthread thread;
+};
+
+AssetWatcher::AssetWatcher()
+    : fd{-1}, watch_dirs{}, ready_mutex{}, ready{}, thread{} {}
+
+AssetWatcher::~AssetWatcher() {
+    if (this->thread.joinable()) {
+        this->thread.request_stop();
+        this->thread.join();
+    }
+    if (this->fd >= 0) {
+        close(this->fd);
+    }
+}
+
+void AssetWatcher::start(const std::vector<std::string> &dirs) {
+    this->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (this->fd < 0) {
+        std::cerr << "Asset hot-reload disabled: inotify unavailable"
+                  << std::endl;
+        return;
+    }
+
+    for (const auto &dir : dirs) {
+        int wd = inotify_add_watch(this->fd, dir.c_str(),
+                                   IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd >= 0) {
+            this->watch_dirs[wd] = dir;
+        }
+    }
+
+    this->thread =
+        std::jthread([this](std::stop_token stop) { this->watch(stop); });
+}
+
+std::vector<ReloadedAsset> AssetWatcher::take() {
+    std::vector<ReloadedAsset> assets;
+    std::unique_lock lock{this->ready_mutex, std::try_to_lock};
+    if (lock.owns_lock()) {
+        assets.swap(this->ready);
+    }
+    return assets;
+}
+
+void AssetWatcher::watch(std::stop_token stop) {
+    alignas(inotify_event) char buffer[4096];
+    pollfd pfd{this->fd, POLLIN, 0};
+
+    while (!stop.stop_requested()) {
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+
+        ssize_t len = read(this->fd, buffer, sizeof(buffer));
+        for (ssize_t i = 0; i < len;) {
+            auto *ev = reinterpret_cast<inotify_event *>(buffer + i);
+            if (ev->len > 0 && this->watch_dirs.contains(ev->wd)) {
+                this->decode(this->watch_dirs[ev->wd] + "/" + ev->name);
+            }
+            i += sizeof(inotify_event) + ev->len;
+        }
+    }
+}
+
+void AssetWatcher::decode(const std::string &path) {
+    ReloadedAsset asset{path, nullptr, nullptr, {}};
+
+    if (path.ends_with(".png")) {
+        asset.surface.reset(resources.track(IMG_Load(path.c_str())));
+        if (!asset.surface) {
+            std::cerr << std::format("Error reloading {}: {}", path,
+                                     IMG_GetError())
+                      << std::endl;
+            return;
+        }
+    } else if (path.starts_with("music/")) {
+        // Music is streamed from the file by MusicStream, not decoded here.
+    } else if (path.ends_with(".ogg")) {
+        asset.chunk.reset(resources.track(Mix_LoadWAV(path.c_str())));
+        if (!asset.chunk) {
+            std::cerr << std::format("Error reloading {}: {}", path,
+                                     Mix_GetError())
+                      << std::endl;
+            return;
+        }
+    } else if (path.ends_with(".ttf")) {
+        std::ifstream file{path, std::ios::binary};
+        asset.bytes.assign(std::istreambuf_iterator<char>{file},
+                           std::istreambuf_iterator<char>{});
+        if (asset.bytes.empty()) {
+            return;
+        }
+    } else {
+        return;
+    }
+
+    std::lock_guard lock{this->ready_mutex};
+    this->ready.push_back(std::move(asset));
+}
+
+// View into the world, in world pixels.
+struct Camera {
+    int x;
+    int y;
+    int w;
+    int h;
+
+    void follow(const SDL_Rect &target, int world_w, int world_h);
+    SDL_Rect to_screen(const SDL_Rect &rect) const;
+};
+
+void Camera::follow(const SDL_Rect &target, int world_w, int world_h) {
+    this->x = target.x + target.w / 2 - this->w / 2;
+    this->y = target.y + target.h / 2 - this->h / 2;
+    this->x = std::clamp(this->x, 0, std::max(0, world_w - this->w));
+    this->y = std::clamp(this->y, 0, std::max(0, world_h - this->h));
+}
+
+SDL_Rect Camera::to_screen(const SDL_Rect &rect) const {
+    return {rect.x - this->x, rect.y - this->y, rect.w, rect.h};
+}
+
+// Tile layer drawn from a tileset texture. Tiles are stored in square
+// chunks so rows of neighbouring tiles sit together in memory, and chunks
+// are only allocated once a tile in them is set. Unset tiles repeat the
+// tileset, so an empty map looks like the tileset image tiled across the
+// world. Only tiles under the camera are visited.
+class TileMap {
+  public:
+    static constexpr int chunk_size{32};
+
+    TileMap();
+
+    void resize(int tiles_x, int tiles_y, int tile_size, int tileset_w,
+                int tileset_h);
+    Uint16 tile(int x, int y) const;
+    void set_tile(int x, int y, Uint16 id);
+    template <typename Fn>
+    void for_each_visible(const Camera &camera, Fn &&fn) const;
+
+    int world_w() const { return this->tiles_x * this->tile_size; }
+    int world_h() const { return this->tiles_y * this->tile_size; }
+
+  private:
+    using Chunk = std::array<Uint16, chunk_size * chunk_size>;
+
+    Uint16 default_tile(int x, int y) const;
+
+    int tiles_x;
+    int tiles_y;
+    int tile_size;
+    int tileset_w;
+    int tileset_h;
+    int tileset_cols;
+    int tileset_rows;
+    int chunks_x;
+    std::vector<std::unique_ptr<Chunk>> chunks;
+};
+
+TileMap::TileMap()
+    : tiles_x{0}, tiles_y{0}, tile_size{1}, tileset_w{1}, tileset_h{1},
+      tileset_cols{1}, tileset_rows{1}, chunks_x{0}, chunks{} {}
+
+void TileMap::resize(int tiles_x, int tiles_y, int tile_size, int tileset_w,
+                     int tileset_h) {
+    this->tiles_x = tiles_x;
+    this->tiles_y = tiles_y;
+    this->tile_size = tile_size;
+    this->tileset_w = tileset_w;
+    this->tileset_h = tileset_h;
+    this->tileset_cols = std::max(1, tileset_w / tile_size);
+    this->tileset_rows = std::max(1, tileset_h / tile_size);
+    this->chunks_x = (tiles_x + chunk_size - 1) / chunk_size;
+    int chunks_y = (tiles_y + chunk_size - 1) / chunk_size;
+    this->chunks.clear();
+    this->chunks.resize(static_cast<std::size_t>(this->chunks_x) * chunks_y);
+}
+
+Uint16 TileMap::default_tile(int x, int y) const {
+    return static_cast<Uint16>((y % this->tileset_rows) * this->tileset_cols +
+                               x % this->tileset_cols);
+}
+
+Uint16 TileMap::tile(int x, int y) const {
+    const auto &chunk =
+        this->chunks[(y / chunk_size) * this->chunks_x + x / chunk_size];
+    if (!chunk) {
+        return this->default_tile(x, y);
+    }
+    return (*chunk)[(y % chunk_size) * chunk_size + x % chunk_size];
+}
+
+void TileMap::set_tile(int x, int y, Uint16 id) {
+    auto &chunk =
+        this->chunks[(y / chunk_size) * this->chunks_x + x / chunk_size];
+    if (!chunk) {
+        chunk = std::make_unique<Chunk>();
+        int x0 = (x / chunk_size) * chunk_size;
+        int y0 = (y / chunk_size) * chunk_size;
+        for (int i = 0; i < chunk_size * chunk_size; i++) {
+            (*chunk)[i] =
+                this->default_tile(x0 + i % chunk_size, y0 + i / chunk_size);
+        }
+    }
+    (*chunk)[(y % chunk_size) * chunk_size + x % chunk_size] = id;
+}
+
+template <typename Fn>
+void TileMap::for_each_visible(const Camera &camera, Fn &&fn) const {
+    int first_x = std::max(0, camera.x / this->tile_size);
+    int first_y = std::max(0, camera.y / this->tile_size);
+    int last_x = std::min(this->tiles_x,
+                          (camera.x + camera.w - 1) / this->tile_size + 1);
+    int last_y = std::min(this->tiles_y,
+                          (camera.y + camera.h - 1) / this->tile_size + 1);
+
+    for (int ty = first_y; ty < last_y; ty++) {
+        for (int tx = first_x; tx < last_x; tx++) {
+            Uint16 id = this->tile(tx, ty);
+            SDL_Rect src{(id % this->tileset_cols) * this->tile_size,
+                         (id / this->tileset_cols) * this->tile_size,
+                         this->tile_size, this->tile_size};
+            SDL_Rect dst{tx * this->tile_size - camera.x,
+                         ty * this->tile_size - camera.y, this->tile_size,
+                         this->tile_size};
+            fn(src, dst);
+        }
+    }
+}
+
+// Fixed set of worker threads that run parallel_for jobs together with the
+// calling thread. parallel_for returns once every job is done and no worker
+// is still inside it, so jobs may reference the caller's stack.
+class ThreadPool {
+  public:
+    ThreadPool();
+    ~ThreadPool();
+
+    void start(unsigned threads);
+    unsigned size() const {
+        return static_cast<unsigned>(this->workers.size()) + 1;
+    }
+
+    template <typename Fn> void parallel_for(int jobs, Fn &&fn);
+
+  private:
+    using Task = void (*)(void *ctx, int job);
+
+    void run(int jobs, Task task, void *ctx);
+    void work(Task task, void *ctx, int jobs);
+    void worker_loop(std::stop_token stop);
+
+    std::mutex mutex;
+    std::condition_variable_any start_cv;
+    std::condition_variable done_cv;
+    std::size_t generation;
+    Task task;
+    void *ctx;
+    int jobs;
+    int active;
+    std::atomic<int> next_job;
+    std::atomic<int> done_jobs;
+    std::vector<std::jthread> workers;
+};
+
+ThreadPool::ThreadPool()
+    : mutex{}, start_cv{}, done_cv{}, generation{0}, task{nullptr},
+      ctx{nullptr}, jobs{0}, active{0}, next_job{0}, done_jobs{0},
+      workers{} {}
+
+ThreadPool::~ThreadPool() {
+    for (auto &worker : this->workers) {
+        worker.request_stop();
+    }
+}
+
+void ThreadPool::start(unsigned threads) {
+    for (unsigned i = 1; i < threads; i++) {
+        this->workers.emplace_back(
+            [this](std::stop_token stop) { this->worker_loop(stop); });
+    }
+}
+
+template <typename Fn> void ThreadPool::parallel_for(int jobs, Fn &&fn) {
+    using F = std::remove_reference_t<Fn>;
+    this->run(
+        jobs, [](void *ctx, int job) { (*static_cast<F *>(ctx))(job); },
+        const_cast<void *>(static_cast<const void *>(&fn)));
+}
+
+void ThreadPool::run(int jobs, Task task, void *ctx) {
+    if (jobs <= 0) {
+        return;
+    }
+
+    {
+        std::lock_guard lock{this->mutex};
+        this->task = task;
+        this->ctx = ctx;
+        this->jobs = jobs;
+        this->next_job = 0;
+        this->done_jobs = 0;
+        this->generation++;
+    }
+    this->start_cv.notify_all();
+
+    this->work(task, ctx, jobs);
+
+    std::unique_lock lock{this->mutex};
+    this->done_cv.wait(lock, [&] {
+        return this->done_jobs.load() == jobs && this->active == 0;
+    });
+}
+
+void ThreadPool::work(Task task, void *ctx, int jobs) {
+    int job;
+    while ((job = this->next_job.fetch_add(1)) < jobs) {
+        task(ctx, job);
+        if (this->done_jobs.fetch_add(1) + 1 == jobs) {
+            std::lock_guard lock{this->mutex};
+            this->done_cv.notify_one();
+        }
+    }
+}
+
+void ThreadPool::worker_loop(std::stop_token stop) {
+    std::size_t seen = 0;
+    while (true) {
+        Task task;
+        void *ctx;
+        int jobs;
+        {
+            std::unique_lock lock{this->mutex};
+            this->start_cv.wait(lock, stop,
+                                [&] { return this->generation != seen; });
+            if (stop.stop_requested()) {
+                return;
+            }
+            seen = this->generation;
+            // A worker that wakes after its run has finished must not join
+            // it: run() may have returned, and ctx may point at a stack
+            // frame that is gone. Joining only happens under the lock while
+            // jobs remain, and run() waits for active to drop back to 0, so
+            // a worker that does join is always done before run() returns.
+            if (this->done_jobs.load() == this->jobs) {
+                continue;
+            }
+            task = this->task;
+            ctx = this->ctx;
+            jobs = this->jobs;
+            this->active++;
+        }
+
+        this->work(task, ctx, jobs);
+
+        std::lock_guard lock{this->mutex};
+        this->active--;
+        this->done_cv.notify_one();
+    }
+}
+
+// Texture rewritten from the CPU every frame. Two streaming textures are
+// used in turn so the one being written is never the one the last frame
+// drew from. Pixels are written straight into the locked texture in row
+// bands of band_rows rows, spread over the thread pool.
+class StreamingTexture {
+  public:
+    StreamingTexture();
+
+    void init(SDL_Renderer *renderer, int w, int h, int band_rows,
+              bool mirror = false);
+    template <typename Fn> void update(ThreadPool &pool, Fn &&fill_rows);
+
+    SDL_Texture *get() const { return this->buffers[this->front].get(); }
+    const Uint32 *pixels() const {
+        return this->mirror.empty() ? nullptr : this->mirror.data();
+    }
+    std::size_t updates() const { return this->update_count; }
+
+  private:
+    std::array<TexturePtr, 2> buffers;
+    std::vector<Uint32> mirror;
+    int front;
+    int w;
+    int h;
+    int band_rows;
+    std::size_t update_count;
+};
+
+StreamingTexture::StreamingTexture()
+    : buffers{}, mirror{}, front{0}, w{0}, h{0}, band_rows{32},
+      update_count{0} {}
+
+// With mirror set, the rows are also kept in memory, tightly packed, for
+// renderers that read pixels back, such as SoftRenderer.
+void StreamingTexture::init(SDL_Renderer *renderer, int w, int h,
+                            int band_rows, bool mirror) {
+    this->w = w;
+    this->h = h;
+    this->band_rows = std::max(1, band_rows);
+    if (mirror) {
+        this->mirror.assign(static_cast<std::size_t>(w) * h, 0);
+    }
+    for (auto &buffer : this->buffers) {
+        buffer.reset(resources.track(
+            SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                              SDL_TEXTUREACCESS_STREAMING, w, h)));
+        if (!buffer) {
+            auto error =
+                std::format("Error creating Texture: {}", SDL_GetError());
+            throw std::runtime_error(error);
+        }
+        SDL_SetTextureBlendMode(buffer.get(), SDL_BLENDMODE_BLEND);
+    }
+}
+
+// fill_rows(pixels, pitch, y0, y1) writes rows y0 to y1 - 1, where pitch is
+// in pixels. A mirrored texture is filled in memory and then uploaded.
+template <typename Fn>
+void StreamingTexture::update(ThreadPool &pool, Fn &&fill_rows) {
+    int back = 1 - this->front;
+    int bands = (this->h + this->band_rows - 1) / this->band_rows;
+    auto fill = [&](Uint32 *pixels, int pitch_px) {
+        pool.parallel_for(bands, [&](int band) {
+            int y0 = band * this->band_rows;
+            fill_rows(pixels, pitch_px, y0,
+                      std::min(this->h, y0 + this->band_rows));
+        });
+    };
+
+    if (!this->mirror.empty()) {
+        fill(this->mirror.data(), this->w);
+        SDL_UpdateTexture(this->buffers[back].get(), nullptr,
+                          this->mirror.data(),
+                          this->w * static_cast<int>(sizeof(Uint32)));
+    } else {
+        void *locked;
+        int pitch;
+        if (SDL_LockTexture(this->buffers[back].get(), nullptr, &locked,
+                            &pitch)) {
+            return;
+        }
+        fill(static_cast<Uint32 *>(locked),
+             pitch / static_cast<int>(sizeof(Uint32)));
+        SDL_UnlockTexture(this->buffers[back].get());
+    }
+    this->front = back;
+    this->update_count++;
+}
+
+// Full-screen plasma that fades out over a short burst, tinted by the
+// colour it was triggered with.
+class PlasmaEffect {
+  public:
+    static constexpr int duration_frames{45};
+
+    PlasmaEffect();
+
+    void init(SDL_Renderer *renderer, int w, int h, int band_rows,
+              bool mirror = false);
+    void trigger(SDL_Color tint);
+    void update(ThreadPool &pool);
+
+    bool active() const { return this->frames_left > 0; }
+    SDL_Texture *texture() const { return this->stream.get(); }
+    const Uint32 *pixels() const { return this->stream.pixels(); }
+    std::size_t updates() const { return this->stream.updates(); }
+
+  private:
+    StreamingTexture stream;
+    std::array<Uint32, 256> palette;
+    std::vector<float> col_wave;
+    std::vector<float> row_wave;
+    std::vector<float> diag_wave;
+    SDL_Color tint;
+    float time;
+    int frames_left;
+};
+
+PlasmaEffect::PlasmaEffect()
+    : stream{}, palette{}, col_wave{}, row_wave{}, diag_wave{},
+      tint{255, 255, 255, 255}, time{0.0f}, frames_left{0} {}
+
+void PlasmaEffect::init(SDL_Renderer *renderer, int w, int h, int band_rows,
+                        bool mirror) {
+    this->stream.init(renderer, w, h, band_rows, mirror);
+    this->col_wave.resize(w);
+    this->row_wave.resize(h);
+    this->diag_wave.resize(w + h);
+}
+
+void PlasmaEffect::trigger(SDL_Color tint) {
+    this->tint = tint;
+    this->frames_left = duration_frames;
+}
+
+void PlasmaEffect::update(ThreadPool &pool) {
+    if (!this->active()) {
+        return;
+    }
+
+    this->time += 0.08f;
+    for (std::size_t x = 0; x < this->col_wave.size(); x++) {
+        this->col_wave[x] = std::sin(x * 0.021f + this->time);
+    }
+    for (std::size_t y = 0; y < this->row_wave.size(); y++) {
+        this->row_wave[y] = std::sin(y * 0.027f + this->time * 1.3f);
+    }
+    for (std::size_t i = 0; i < this->diag_wave.size(); i++) {
+        this->diag_wave[i] = std::sin(i * 0.013f + this->time * 0.7f);
+    }
+
+    Uint32 alpha = 160 * this->frames_left / duration_frames;
+    for (int i = 0; i < 256; i++) {
+        float wave = 0.5f + 0.5f * std::sin(i * 0.0491f + this->time);
+        auto r = static_cast<Uint32>(this->tint.r * wave);
+        auto g = static_cast<Uint32>(this->tint.g * (1.0f - wave));
+        auto b = static_cast<Uint32>(this->tint.b * wave);
+        this->palette[i] = (alpha << 24) | (r << 16) | (g << 8) | b;
+    }
+
+    int w = static_cast<int>(this->col_wave.size());
+    this->stream.update(pool, [&](Uint32 *pixels, int pitch, int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            Uint32 *row = pixels + y * pitch;
+            float row_value = this->row_wave[y] + 3.0f;
+            const float *diag = this->diag_wave.data() + y;
+            for (int x = 0; x < w; x++) {
+                float v = this->col_wave[x] + row_value + diag[x];
+                row[x] = this->palette[static_cast<int>(v * 42.5f) & 0xff];
+            }
+        }
+    });
+
+    this->frames_left--;
+}
+
+// Versioned binary save state. A short header is followed by blocks
+// copied straight from memory, with arrays written whole, so saving and
+// restoring are little more than memcpy. The blocks are in host layout,
+// so a snapshot is meant for rewinding and replaying within one build, and
+// the version is bumped whenever a block changes.
+class Snapshot {
+  public:
+    static constexpr std::array<char, 4> magic{'S', 'D', 'L', 'S'};
+    static constexpr Uint32 version{2};
+
+    Snapshot();
+
+    void begin_write();
+    void begin_read();
+    void write(const void *src, std::size_t bytes);
+    void read(void *dst, std::size_t bytes);
+
+    template <typename T> void write_value(const T &value);
+    template <typename T> void read_value(T &value);
+
+    bool empty() const { return this->data.empty(); }
+    std::vector<std::byte> &bytes() { return this->data; }
+    const std::vector<std::byte> &bytes() const { return this->data; }
+
+  private:
+    std::vector<std::byte> data;
+    std::size_t read_pos;
+};
+
+Snapshot::Snapshot() : data{}, read_pos{0} {}
+
+void Snapshot::begin_write() {
+    this->data.clear();
+    this->write_value(magic);
+    this->write_value(version);
+}
+
+void Snapshot::begin_read() {
+    this->read_pos = 0;
+    std::array<char, 4> file_magic;
+    Uint32 file_version;
+    this->read_value(file_magic);
+    this->read_value(file_version);
+    if (file_magic != magic || file_version != version) {
+        throw std::runtime_error("Error reading Snapshot: wrong format");
+    }
+}
+
+// Appending keeps the capacity of earlier snapshots, so saving into the
+// same Snapshot again does not allocate.
+void Snapshot::write(const void *src, std::size_t bytes) {
+    const auto *begin = static_cast<const std::byte *>(src);
+    this->data.insert(this->data.end(), begin, begin + bytes);
+}
+
+void Snapshot::read(void *dst, std::size_t bytes) {
+    if (bytes > this->data.size() - this->read_pos) {
+        throw std::runtime_error("Error reading Snapshot: truncated");
+    }
+    std::memcpy(dst, this->data.data() + this->read_pos, bytes);
+    this->read_pos += bytes;
+}
+
+template <typename T> void Snapshot::write_value(const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    this->write(&value, sizeof(T));
+}
+
+template <typename T> void Snapshot::read_value(T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    this->read(&value, sizeof(T));
+}
+
+// Delta between consecutive snapshots: the new size, then runs of
+// (unchanged byte count, changed byte count, changed bytes). Snapshots are
+// compared eight bytes at a time, so runs are in whole words apart from
+// the tail.
+void encode_delta(const std::vector<std::byte> &prev,
+                  const std::vector<std::byte> &cur,
+                  std::vector<std::byte> &out) {
+    auto put = [&out](Uint64 value) {
+        const auto *begin = reinterpret_cast<const std::byte *>(&value);
+        out.insert(out.end(), begin, begin + sizeof(value));
+    };
+    auto same_word = [&](std::size_t pos) {
+        std::size_t len = std::min<std::size_t>(8, cur.size() - pos);
+        return pos + len <= prev.size() &&
+               std::memcmp(prev.data() + pos, cur.data() + pos, len) == 0;
+    };
+
+    out.clear();
+    put(cur.size());
+    for (std::size_t pos = 0; pos < cur.size();) {
+        std::size_t same = pos;
+        while (same < cur.size() && same_word(same)) {
+            same += 8;
+        }
+        same = std::min(same, cur.size());
+        std::size_t changed = same;
+        while (changed < cur.size() && !same_word(changed)) {
+            changed += 8;
+        }
+        changed = std::min(changed, cur.size());
+
+        put(same - pos);
+        put(changed - same);
+        out.insert(out.end(), cur.begin() + same, cur.begin() + changed);
+        pos = changed;
+    }
+}
+
+void decode_delta(const std::vector<std::byte> &prev,
+                  const std::vector<std::byte> &delta,
+                  std::vector<std::byte> &out) {
+    std::size_t in = 0;
+    auto get = [&]() {
+        Uint64 value;
+        if (sizeof(value) > delta.size() - in) {
+            throw std::runtime_error("Error reading Snapshot delta");
+        }
+        std::memcpy(&value, delta.data() + in, sizeof(value));
+        in += sizeof(value);
+        return static_cast<std::size_t>(value);
+    };
+
+    out.resize(get());
+    for (std::size_t pos = 0; pos < out.size();) {
+        std::size_t same = get();
+        std::size_t changed = get();
+        if (same + changed > out.size() - pos || pos + same > prev.size() ||
+            changed > delta.size() - in) {
+            throw std::runtime_error("Error reading Snapshot delta");
+        }
+        std::copy_n(prev.begin() + pos, same, out.begin() + pos);
+        pos += same;
+        std::copy_n(delta.begin() + in, changed, out.begin() + pos);
+        in += changed;
+        pos += changed;
+    }
+}
+
+// Steps bodies stored as separate arrays under dv/dt = a - damping * v,
+// using the exact solution for an acceleration held over the step:
+//   v' = v e + a (1 - e) / k
+//   x' = x + v (1 - e) / k + a (dt - (1 - e) / k) / k
+// with k the damping rate and e = exp(-k dt). The result does not depend
+// on how a span of time is cut into steps, so bodies cover the same ground
+// at any tick rate. A damping of 0 gives plain constant acceleration. The
+// coefficients are worked out once, and accel(i) gives body i's
+// acceleration, so constant and per-body forces both compile to one
+// straight loop the compiler can vectorize. Particles and moving bodies
+// both go through here.
+template <typename Accel>
+void integrate_motion(float *__restrict x, float *__restrict y,
+                      float *__restrict vx, float *__restrict vy,
+                      std::size_t count, float damping, float dt,
+                      Accel &&accel) {
+    double k = damping;
+    double kdt = k * dt;
+    double decay = std::exp(-kdt);
+    // Series forms for small k dt, where the closed forms lose precision.
+    double from_v = kdt < 1e-3 ? dt * (1.0 - kdt / 2.0) : -std::expm1(-kdt) / k;
+    double from_a = kdt < 1e-3 ? dt * dt / 2.0 * (1.0 - kdt / 3.0)
+                               : (dt - from_v) / k;
+    auto e = static_cast<float>(decay);
+    auto cv = static_cast<float>(from_v);
+    auto ca = static_cast<float>(from_a);
+
+    for (std::size_t i = 0; i < count; i++) {
+        auto [ax, ay] = accel(i);
+        x[i] += vx[i] * cv + ax * ca;
+        y[i] += vy[i] * cv + ay * ca;
+        vx[i] = vx[i] * e + ax * cv;
+        vy[i] = vy[i] * e + ay * cv;
+    }
+}
+
+// Fixed-capacity particle pool stored as separate arrays per field, so the
+// update loop is a straight pass the compiler can vectorize. Dead particles
+// are removed by swapping the last live one into their slot. Bursts that do
+// not fit are cut short, and nothing allocates after construction.
+class ParticleSystem {
+  public:
+    static constexpr float gravity{400.0f};
+    static constexpr float particle_size{4.0f};
+
+    ParticleSystem(std::size_t capacity, std::size_t chunk_size);
+
+    void burst(float x, float y, int count, SDL_Color color,
+               std::mt19937 &gen);
+    void update(float dt);
+    void update(float dt, ThreadPool &pool);
+    void build_quads(const Camera &camera);
+    void draw(SDL_Renderer *renderer, const Camera &camera);
+    void save(Snapshot &snapshot) const;
+    void restore(Snapshot &snapshot);
+
+    std::size_t size() const { return this->count; }
+    std::size_t capacity() const { return this->x.size(); }
+    std::span<const SDL_Vertex> quads() const {
+        return {this->vertices.data(), this->count * 4};
+    }
+    std::span<const int> quad_indices() const {
+        return {this->indices.data(), this->count * 6};
+    }
+
+  private:
+    void integrate(std::size_t begin, std::size_t end, float dt);
+    void remove_dead();
+
+    std::size_t chunk_size;
+    std::size_t count;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> vx;
+    std::vector<float> vy;
+    std::vector<float> life;
+    std::vector<float> max_life;
+    std::vector<SDL_Color> color;
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+};
+
+// Threaded updates hand the pool chunk_size particles per job.
+ParticleSystem::ParticleSystem(std::size_t capacity, std::size_t chunk_size)
+    : chunk_size{std::max<std::size_t>(1, chunk_size)}, count{0},
+      x(capacity), y(capacity), vx(capacity), vy(capacity), life(capacity),
+      max_life(capacity), color(capacity), vertices(capacity * 4),
+      indices(capacity * 6) {
+    for (std::size_t i = 0; i < capacity; i++) {
+        int base = static_cast<int>(i * 4);
+        int *quad = this->indices.data() + i * 6;
+        quad[0] = base;
+        quad[1] = base + 1;
+        quad[2] = base + 2;
+        quad[3] = base;
+        quad[4] = base + 2;
+        quad[5] = base + 3;
+    }
+}
+
+void ParticleSystem::burst(float x, float y, int count, SDL_Color color,
+                           std::mt19937 &gen) {
+    std::uniform_real_distribution<float> angle{0.0f, 6.2831853f};
+    std::uniform_real_distribution<float> speed{60.0f, 260.0f};
+    std::uniform_real_distribution<float> lifetime{0.4f, 1.2f};
+
+    for (int n = 0; n < count && this->count < this->capacity(); n++) {
+        std::size_t i = this->count++;
+        float a = angle(gen);
+        float v = speed(gen);
+        this->x[i] = x;
+        this->y[i] = y;
+        this->vx[i] = std::cos(a) * v;
+        this->vy[i] = std::sin(a) * v;
+        this->life[i] = this->max_life[i] = lifetime(gen);
+        this->color[i] = color;
+    }
+}
+
+void ParticleSystem::integrate(std::size_t begin, std::size_t end, float dt) {
+    integrate_motion(this->x.data() + begin, this->y.data() + begin,
+                     this->vx.data() + begin, this->vy.data() + begin,
+                     end - begin, 0.0f, dt,
+                     [](std::size_t) { return std::pair{0.0f, gravity}; });
+
+    float *__restrict plife = this->life.data();
+    for (std::size_t i = begin; i < end; i++) {
+        plife[i] -= dt;
+    }
+}
+
+void ParticleSystem::remove_dead() {
+    for (std::size_t i = 0; i < this->count;) {
+        if (this->life[i] > 0.0f) {
+            i++;
+            continue;
+        }
+        std::size_t last = --this->count;
+        this->x[i] = this->x[last];
+        this->y[i] = this->y[last];
+        this->vx[i] = this->vx[last];
+        this->vy[i] = this->vy[last];
+        this->life[i] = this->life[last];
+        this->max_life[i] = this->max_life[last];
+        this->color[i] = this->color[last];
+    }
+}
+
+// Writes the live count and then the live part of each field array.
+void ParticleSystem::save(Snapshot &snapshot) const {
+    Uint64 live = this->count;
+    snapshot.write_value(live);
+    for (const auto *field : {&this->x, &this->y, &this->vx, &this->vy,
+                              &this->life, &this->max_life}) {
+        snapshot.write(field->data(), this->count * sizeof(float));
+    }
+    snapshot.write(this->color.data(), this->count * sizeof(SDL_Color));
+}
+
+void ParticleSystem::restore(Snapshot &snapshot) {
+    Uint64 live;
+    snapshot.read_value(live);
+    if (live > this->capacity()) {
+        throw std::runtime_error("Error reading Snapshot: too many particles");
+    }
+    this->count = static_cast<std::size_t>(live);
+    for (auto *field : {&this->x, &this->y, &this->vx, &this->vy, &this->life,
+                        &this->max_life}) {
+        snapshot.read(field->data(), this->count * sizeof(float));
+    }
+    snapshot.read(this->color.data(), this->count * sizeof(SDL_Color));
+}
+
+void ParticleSystem::update(float dt) {
+    this->integrate(0, this->count, dt);
+    this->remove_dead();
+}
+
+void ParticleSystem::update(float dt, ThreadPool &pool) {
+    std::size_t size = this->chunk_size;
+    int chunks = static_cast<int>((this->count + size - 1) / size);
+    pool.parallel_for(chunks, [&](int chunk) {
+        std::size_t begin = chunk * size;
+        this->integrate(begin, std::min(this->count, begin + size), dt);
+    });
+    this->remove_dead();
+}
+
+// Particles live in world space and are drawn through the camera. The
+// quads are rebuilt in screen space each frame, ready to be drawn directly
+// or submitted to a render queue.
+void ParticleSystem::build_quads(const Camera &camera) {
+    float half = particle_size / 2.0f;
+    for (std::size_t i = 0; i < this->count; i++) {
+        SDL_Color c = this->color[i];
+        c.a = static_cast<Uint8>(255.0f * this->life[i] / this->max_life[i]);
+        float x0 = this->x[i] - half - camera.x;
+        float y0 = this->y[i] - half - camera.y;
+        float x1 = x0 + particle_size;
+        float y1 = y0 + particle_size;
+
+        SDL_Vertex *quad = this->vertices.data() + i * 4;
+        quad[0] = {{x0, y0}, c, {0.0f, 0.0f}};
+        quad[1] = {{x1, y0}, c, {0.0f, 0.0f}};
+        quad[2] = {{x1, y1}, c, {0.0f, 0.0f}};
+        quad[3] = {{x0, y1}, c, {0.0f, 0.0f}};
+    }
+}
+
+void ParticleSystem::draw(SDL_Renderer *renderer, const Camera &camera) {
+    if (this->count == 0) {
+        return;
+    }
+
+    this->build_quads(camera);
+    SDL_RenderGeometry(renderer, nullptr, this->vertices.data(),
+                       static_cast<int>(this->count * 4),
+                       this->indices.data(),
+                       static_cast<int>(this->count * 6));
+}
+
+// Bodies the player or scripts steer, stored as separate arrays like the
+// particles. Each tick a body accelerates along its input direction, loses
+// speed to exponential damping and is kept inside the bounds, stopping on
+// the axis it hit. Steps are integrated exactly, so neither a body's speed
+// nor the distance it covers depends on the tick rate, and its top speed is
+// accel / damping.
+class MotionSystem {
+  public:
+    MotionSystem(float accel, float damping);
+
+    std::size_t add(float w, float h);
+    void set_bounds(float w, float h);
+    void set_size(std::size_t body, float w, float h);
+    void steer(std::size_t body, float dir_x, float dir_y);
+    void update(float dt);
+    SDL_Rect rect(std::size_t body) const;
+    float speed(std::size_t body) const;
+    void save(Snapshot &snapshot) const;
+    void restore(Snapshot &snapshot);
+
+  private:
+    float accel;
+    float damping;
+    float bounds_w;
+    float bounds_h;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> vx;
+    std::vector<float> vy;
+    std::vector<float> ax;
+    std::vector<float> ay;
+    std::vector<float> w;
+    std::vector<float> h;
+};
+
+MotionSystem::MotionSystem(float accel, float damping)
+    : accel{accel}, damping{damping}, bounds_w{0.0f}, bounds_h{0.0f}, x{},
+      y{}, vx{}, vy{}, ax{}, ay{}, w{}, h{} {}
+
+std::size_t MotionSystem::add(float w, float h) {
+    for (auto *field : {&this->x, &this->y, &this->vx, &this->vy, &this->ax,
+                        &this->ay}) {
+        field->push_back(0.0f);
+    }
+    this->w.push_back(w);
+    this->h.push_back(h);
+    return this->x.size() - 1;
+}
+
+void MotionSystem::set_bounds(float w, float h) {
+    this->bounds_w = w;
+    this->bounds_h = h;
+}
+
+void MotionSystem::set_size(std::size_t body, float w, float h) {
+    this->w[body] = w;
+    this->h[body] = h;
+}
+
+// The direction is scaled down to unit length if longer, so moving
+// diagonally is no faster than moving straight.
+void MotionSystem::steer(std::size_t body, float dir_x, float dir_y) {
+    float length = std::sqrt(dir_x * dir_x + dir_y * dir_y);
+    if (length > 1.0f) {
+        dir_x /= length;
+        dir_y /= length;
+    }
+    this->ax[body] = dir_x * this->accel;
+    this->ay[body] = dir_y * this->accel;
+}
+
+void MotionSystem::update(float dt) {
+    const float *__restrict pax = this->ax.data();
+    const float *__restrict pay = this->ay.data();
+    integrate_motion(this->x.data(), this->y.data(), this->vx.data(),
+                     this->vy.data(), this->x.size(), this->damping, dt,
+                     [pax, pay](std::size_t i) {
+                         return std::pair{pax[i], pay[i]};
+                     });
+
+    for (std::size_t i = 0; i < this->x.size(); i++) {
+        float max_x = std::max(0.0f, this->bounds_w - this->w[i]);
+        float max_y = std::max(0.0f, this->bounds_h - this->h[i]);
+        if (this->x[i] < 0.0f || this->x[i] > max_x) {
+            this->x[i] = std::clamp(this->x[i], 0.0f, max_x);
+            this->vx[i] = 0.0f;
+        }
+        if (this->y[i] < 0.0f || this->y[i] > max_y) {
+            this->y[i] = std::clamp(this->y[i], 0.0f, max_y);
+            this->vy[i] = 0.0f;
+        }
+    }
+}
+
+SDL_Rect MotionSystem::rect(std::size_t body) const {
+    return {static_cast<int>(std::lround(this->x[body])),
+            static_cast<int>(std::lround(this->y[body])),
+            static_cast<int>(this->w[body]), static_cast<int>(this->h[body])};
+}
+
+float MotionSystem::speed(std::size_t body) const {
+    return std::hypot(this->vx[body], this->vy[body]);
+}
+
+void MotionSystem::save(Snapshot &snapshot) const {
+    Uint64 bodies = this->x.size();
+    snapshot.write_value(bodies);
+    for (const auto *field : {&this->x, &this->y, &this->vx, &this->vy,
+                              &this->ax, &this->ay, &this->w, &this->h}) {
+        snapshot.write(field->data(), field->size() * sizeof(float));
+    }
+}
+
+void MotionSystem::restore(Snapshot &snapshot) {
+    Uint64 bodies;
+    snapshot.read_value(bodies);
+    if (bodies != this->x.size()) {
+        throw std::runtime_error("Error reading Snapshot: body count differs");
+    }
+    for (auto *field : {&this->x, &this->y, &this->vx, &this->vy, &this->ax,
+                        &this->ay, &this->w, &this->h}) {
+        snapshot.read(field->data(), field->size() * sizeof(float));
+    }
+}
+
+enum class RenderBackend { Accelerated, SdlSoftware, Soft };
+
+// Renders into a CPU framebuffer using every core. Images are kept with
+// premultiplied alpha. Draw calls are recorded during the frame, then
+// present() splits the target into tiles that the thread pool rasterizes
+// independently. The finished frame goes to the window through one
+// streaming texture. Untextured triangles are binned to the tiles they
+// touch when they are recorded, so a tile only visits its own triangles.
+class SoftRenderer {
+  public:
+    static constexpr int tile_size{64};
+
+    SoftRenderer();
+
+    void init(SDL_Renderer *renderer, ThreadPool *pool, int w, int h);
+    void upload(SDL_Texture *texture, SDL_Surface *surf);
+    void update(SDL_Texture *texture, const Uint32 *pixels, int w, int h);
+    void clear(SDL_Color color);
+    void copy(SDL_Texture *texture, const SDL_Rect *src, const SDL_Rect *dst);
+    void fill(std::span<const SDL_Vertex> vertices,
+              std::span<const int> indices);
+    void present(SDL_Renderer *renderer);
+
+  private:
+    // A null image marks a fill, which draws the triangles numbered
+    // [first_triangle, end_triangle).
+    struct Command {
+        const SDL_Surface *image;
+        SDL_Rect src;
+        SDL_Rect dst;
+        Uint32 first_triangle;
+        Uint32 end_triangle;
+    };
+
+    struct Triangle {
+        std::array<SDL_FPoint, 3> points;
+        SDL_Rect bounds;
+        Uint32 color;
+    };
+
+    void raster_tile(int tile);
+    void raster_command(const Command &cmd, const SDL_Rect &clip);
+    void raster_triangle(const Triangle &tri, const SDL_Rect &clip);
+
+    int w;
+    int h;
+    int tiles_x;
+    int tiles_y;
+    std::vector<Uint32> framebuffer;
+    Uint32 clear_color;
+    std::unordered_map<SDL_Texture *, SurfacePtr> images;
+    std::vector<Command> commands;
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<Uint32>> bins;
+    TexturePtr target;
+    ThreadPool *pool;
+    bool warned_missing;
+};
+
+SoftRenderer::SoftRenderer()
+    : w{0}, h{0}, tiles_x{0}, tiles_y{0}, framebuffer{}, clear_color{0},
+      images{}, commands{}, triangles{}, bins{}, target{nullptr},
+      pool{nullptr}, warned_missing{false} {}
+
+void SoftRenderer::init(SDL_Renderer *renderer, ThreadPool *pool, int w,
+                        int h) {
+    this->pool = pool;
+    this->w = w;
+    this->h = h;
+    this->tiles_x = (w + tile_size - 1) / tile_size;
+    this->tiles_y = (h + tile_size - 1) / tile_size;
+    this->framebuffer.assign(static_cast<std::size_t>(w) * h, 0);
+    this->bins.assign(static_cast<std::size_t>(this->tiles_x) * this->tiles_y,
+                      {});
+
+    this->target.reset(resources.track(
+        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                          SDL_TEXTUREACCESS_STREAMING, w, h)));
+    if (!this->target) {
+        auto error = std::format("Error creating Texture: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+}
+
+void SoftRenderer::upload(SDL_Texture *texture, SDL_Surface *surf) {
+    SurfacePtr image{resources.track(SDL_CreateRGBSurfaceWithFormat(
+        0, surf->w, surf->h, 32, SDL_PIXELFORMAT_ARGB8888))};
+    if (!image) {
+        auto error = std::format("Error creating Surface: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+
+    auto *pixels = static_cast<Uint32 *>(image->pixels);
+    int pitch = image->pitch / static_cast<int>(sizeof(Uint32));
+    surface_to_argb(surf, pixels, pitch);
+    for (int y = 0; y < image->h; y++) {
+        premultiply(pixels + y * pitch, pixels + y * pitch, image->w);
+    }
+
+    this->images[texture] = std::move(image);
+}
+
+// Refreshes the image of a streaming texture from its mirrored ARGB8888
+// rows. The image is reused while the size stays the same, so per-frame
+// updates do not allocate.
+void SoftRenderer::update(SDL_Texture *texture, const Uint32 *pixels, int w,
+                          int h) {
+    SurfacePtr &image = this->images[texture];
+    if (!image || image->w != w || image->h != h) {
+        image.reset(resources.track(SDL_CreateRGBSurfaceWithFormat(
+            0, w, h, 32, SDL_PIXELFORMAT_ARGB8888)));
+        if (!image) {
+            auto error =
+                std::format("Error creating Surface: {}", SDL_GetError());
+            throw std::runtime_error(error);
+        }
+    }
+
+    auto *dst = static_cast<Uint32 *>(image->pixels);
+    int pitch = image->pitch / static_cast<int>(sizeof(Uint32));
+    for (int y = 0; y < h; y++) {
+        premultiply(dst + y * pitch, pixels + y * w, w);
+    }
+}
+
+void SoftRenderer::clear(SDL_Color color) {
+    this->clear_color = (Uint32{color.a} << 24) | (Uint32{color.r} << 16) |
+                        (Uint32{color.g} << 8) | color.b;
+}
+
+void SoftRenderer::copy(SDL_Texture *texture, const SDL_Rect *src,
+                        const SDL_Rect *dst) {
+    auto it = this->images.find(texture);
+    if (it == this->images.end()) {
+        if (!this->warned_missing) {
+            std::cerr << "Soft renderer: skipping a texture that has no image"
+                      << std::endl;
+            this->warned_missing = true;
+        }
+        return;
+    }
+
+    const SDL_Surface *image = it->second.get();
+    SDL_Rect full_src{0, 0, image->w, image->h};
+    SDL_Rect full_dst{0, 0, this->w, this->h};
+    this->commands.push_back(
+        {image, src ? *src : full_src, dst ? *dst : full_dst, 0, 0});
+}
+
+// Records indexed triangles, each filled with the colour of its first
+// vertex; the shapes drawn this way (particles, the HUD graph) are single
+// coloured. Triangles are wound one way so that an edge shared by two of
+// them is claimed by exactly one.
+void SoftRenderer::fill(std::span<const SDL_Vertex> vertices,
+                        std::span<const int> indices) {
+    Uint32 first = static_cast<Uint32>(this->triangles.size());
+    for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+        const SDL_Vertex &a = vertices[indices[i]];
+        Triangle tri{{a.position, vertices[indices[i + 1]].position,
+                      vertices[indices[i + 2]].position},
+                     {},
+                     0};
+        auto [p0, p1, p2] = tri.points;
+        float area = (p1.x - p0.x) * (p2.y - p0.y) -
+                     (p1.y - p0.y) * (p2.x - p0.x);
+        if (area == 0.0f || a.color.a == 0) {
+            continue;
+        }
+        if (area < 0.0f) {
+            std::swap(tri.points[1], tri.points[2]);
+        }
+
+        float min_x = std::min({p0.x, p1.x, p2.x});
+        float min_y = std::min({p0.y, p1.y, p2.y});
+        float max_x = std::max({p0.x, p1.x, p2.x});
+        float max_y = std::max({p0.y, p1.y, p2.y});
+        int x0 = std::max(0, static_cast<int>(std::floor(min_x)));
+        int y0 = std::max(0, static_cast<int>(std::floor(min_y)));
+        int x1 = std::min(this->w, static_cast<int>(std::ceil(max_x)));
+        int y1 = std::min(this->h, static_cast<int>(std::ceil(max_y)));
+        if (x0 >= x1 || y0 >= y1) {
+            continue;
+        }
+        tri.bounds = {x0, y0, x1 - x0, y1 - y0};
+
+        Uint32 argb = (Uint32{a.color.a} << 24) | (Uint32{a.color.r} << 16) |
+                      (Uint32{a.color.g} << 8) | a.color.b;
+        premultiply(&tri.color, &argb, 1);
+
+        Uint32 n = static_cast<Uint32>(this->triangles.size());
+        for (int ty = y0 / tile_size; ty <= (y1 - 1) / tile_size; ty++) {
+            for (int tx = x0 / tile_size; tx <= (x1 - 1) / tile_size; tx++) {
+                this->bins[ty * this->tiles_x + tx].push_back(n);
+            }
+        }
+        this->triangles.push_back(tri);
+    }
+
+    Uint32 end = static_cast<Uint32>(this->triangles.size());
+    if (end != first) {
+        this->commands.push_back({nullptr, {}, {}, first, end});
+    }
+}
+
+void SoftRenderer::present(SDL_Renderer *renderer) {
+    this->pool->parallel_for(this->tiles_x * this->tiles_y,
+                             [this](int tile) { this->raster_tile(tile); });
+
+    SDL_UpdateTexture(this->target.get(), nullptr, this->framebuffer.data(),
+                      this->w * static_cast<int>(sizeof(Uint32)));
+    SDL_RenderCopy(renderer, this->target.get(), nullptr, nullptr);
+    this->commands.clear();
+    this->triangles.clear();
+    for (auto &bin : this->bins) {
+        bin.clear();
+    }
+}
+
+void SoftRenderer::raster_tile(int tile) {
+    SDL_Rect clip{(tile % this->tiles_x) * tile_size,
+                  (tile / this->tiles_x) * tile_size, tile_size, tile_size};
+    clip.w = std::min(clip.w, this->w - clip.x);
+    clip.h = std::min(clip.h, this->h - clip.y);
+
+    for (int y = clip.y; y < clip.y + clip.h; y++) {
+        Uint32 *row = this->framebuffer.data() + y * this->w + clip.x;
+        std::fill(row, row + clip.w, this->clear_color);
+    }
+
+    // Bins hold triangle numbers in recording order, so one cursor walks
+    // the bin alongside the commands.
+    const std::vector<Uint32> &bin = this->bins[tile];
+    std::size_t next = 0;
+    for (const auto &cmd : this->commands) {
+        if (cmd.image) {
+            this->raster_command(cmd, clip);
+            continue;
+        }
+        for (; next < bin.size() && bin[next] < cmd.end_triangle; next++) {
+            this->raster_triangle(this->triangles[bin[next]], clip);
+        }
+    }
+}
+
+void SoftRenderer::raster_command(const Command &cmd, const SDL_Rect &clip) {
+    int x0 = std::max(cmd.dst.x, clip.x);
+    int y0 = std::max(cmd.dst.y, clip.y);
+    int x1 = std::min(cmd.dst.x + cmd.dst.w, clip.x + clip.w);
+    int y1 = std::min(cmd.dst.y + cmd.dst.h, clip.y + clip.h);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    const auto *pixels = static_cast<const Uint8 *>(cmd.image->pixels);
+    bool unscaled = cmd.src.w == cmd.dst.w;
+    std::array<Uint32, tile_size> scaled;
+
+    for (int y = y0; y < y1; y++) {
+        int sy = cmd.src.y + (y - cmd.dst.y) * cmd.src.h / cmd.dst.h;
+        const auto *src_row =
+            reinterpret_cast<const Uint32 *>(pixels + sy * cmd.image->pitch);
+        Uint32 *dst_row = this->framebuffer.data() + y * this->w;
+
+        const Uint32 *span;
+        if (unscaled) {
+            span = src_row + cmd.src.x + (x0 - cmd.dst.x);
+        } else {
+            for (int x = x0; x < x1; x++) {
+                int sx = cmd.src.x + (x - cmd.dst.x) * cmd.src.w / cmd.dst.w;
+                scaled[x - x0] = src_row[sx];
+            }
+            span = scaled.data();
+        }
+        blend_premultiplied(dst_row + x0, span, x1 - x0);
+    }
+}
+
+// Covers the pixels whose centres are inside the triangle. A centre lying
+// exactly on an edge belongs to the triangle only for edges running down,
+// or right along a row, which the neighbour sharing it runs the other way.
+void SoftRenderer::raster_triangle(const Triangle &tri, const SDL_Rect &clip) {
+    int x0 = std::max(tri.bounds.x, clip.x);
+    int y0 = std::max(tri.bounds.y, clip.y);
+    int x1 = std::min(tri.bounds.x + tri.bounds.w, clip.x + clip.w);
+    int y1 = std::min(tri.bounds.y + tri.bounds.h, clip.y + clip.h);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    std::array<Uint32, tile_size> solid;
+    solid.fill(tri.color);
+
+    auto inside = [&tri](float px, float py) {
+        for (int i = 0; i < 3; i++) {
+            SDL_FPoint a = tri.points[i];
+            SDL_FPoint b = tri.points[(i + 1) % 3];
+            float dx = b.x - a.x;
+            float dy = b.y - a.y;
+            float e = dx * (py - a.y) - dy * (px - a.x);
+            if (e < 0.0f || (e == 0.0f && !(dy > 0.0f ||
+                                            (dy == 0.0f && dx > 0.0f)))) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    for (int y = y0; y < y1; y++) {
+        float py = static_cast<float>(y) + 0.5f;
+        int start = x0;
+        while (start < x1 && !inside(static_cast<float>(start) + 0.5f, py)) {
+            start++;
+        }
+        int end = start;
+        while (end < x1 && inside(static_cast<float>(end) + 0.5f, py)) {
+            end++;
+        }
+        if (start < end) {
+            blend_premultiplied(this->framebuffer.data() + y * this->w + start,
+                                solid.data(), end - start);
+        }
+    }
+}
+
+struct RenderQueueStats {
+    std::size_t frames{0};
+    std::size_t commands{0};
+    std::size_t draw_calls{0};
+    std::size_t texture_changes{0};
+    std::size_t blend_changes{0};
+    double sort_ms{0.0};
+};
+
+// Collects the frame's texture copies and draws them in sort-key order.
+// Keys pack the layer (8 bits), a per-frame texture id (16 bits) and a
+// depth (32 bits), so layers are drawn in order and, inside a layer, all
+// copies of one texture run together and go out as one geometry call. The
+// radix sort is stable, so equal keys keep their submission order.
+// Untextured shapes are queued the same way under the null texture, and
+// the shapes of a layer run together as one geometry call.
+class RenderQueue {
+  public:
+    RenderQueue();
+
+    void set_output(int w, int h);
+    void submit(Uint8 layer, SDL_Texture *texture, const SDL_Rect *src,
+                const SDL_Rect *dst, Uint32 depth = 0);
+    void submit_shape(Uint8 layer, std::span<const SDL_Vertex> vertices,
+                      std::span<const int> indices, Uint32 depth = 0);
+    void sort();
+    void flush(SDL_Renderer *renderer);
+    void flush(SoftRenderer &soft);
+
+    const RenderQueueStats &stats() const { return this->totals; }
+    std::size_t last_draw_calls() const { return this->frame_draw_calls; }
+
+  private:
+    struct TextureInfo {
+        SDL_Texture *texture;
+        int w;
+        int h;
+        SDL_BlendMode blend;
+    };
+
+    // Shapes have a null texture and refer to their part of the frame's
+    // shape vertices and indices.
+    struct Command {
+        SDL_Texture *texture;
+        SDL_Rect src;
+        SDL_Rect dst;
+        Uint32 first_vertex;
+        Uint32 vertex_count;
+        Uint32 first_index;
+        Uint32 index_count;
+    };
+
+    struct Entry {
+        Uint64 key;
+        Uint32 index;
+    };
+
+    Uint16 texture_id(SDL_Texture *texture);
+    void push_entry(Uint8 layer, Uint16 id, Uint32 depth);
+    void submit_run(SDL_Renderer *renderer, const TextureInfo &info);
+    void finish();
+
+    int output_w;
+    int output_h;
+    std::vector<TextureInfo> textures;
+    std::vector<Command> commands;
+    std::vector<Entry> entries;
+    std::vector<Entry> scratch;
+    std::vector<SDL_Vertex> shape_vertices;
+    std::vector<int> shape_indices;
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+    std::size_t frame_draw_calls;
+    RenderQueueStats totals;
+};
+
+RenderQueue::RenderQueue()
+    : output_w{0}, output_h{0}, textures{}, commands{}, entries{},
+      scratch{}, shape_vertices{}, shape_indices{}, vertices{}, indices{},
+      frame_draw_calls{0}, totals{} {}
+
+void RenderQueue::set_output(int w, int h) {
+    this->output_w = w;
+    this->output_h = h;
+}
+
+// A frame only uses a handful of textures, so a linear search of the
+// frame's list beats a hash map, and clearing the list each frame keeps
+// its capacity instead of freeing nodes.
+Uint16 RenderQueue::texture_id(SDL_Texture *texture) {
+    for (std::size_t i = this->textures.size(); i-- > 0;) {
+        if (this->textures[i].texture == texture) {
+            return static_cast<Uint16>(i);
+        }
+    }
+
+    // Shapes carry their alpha in the vertex colours, so they always blend.
+    TextureInfo info{texture, 0, 0, SDL_BLENDMODE_BLEND};
+    if (texture) {
+        SDL_QueryTexture(texture, nullptr, nullptr, &info.w, &info.h);
+        SDL_GetTextureBlendMode(texture, &info.blend);
+    }
+    this->textures.push_back(info);
+    return static_cast<Uint16>(this->textures.size() - 1);
+}
+
+void RenderQueue::submit(Uint8 layer, SDL_Texture *texture,
+                         const SDL_Rect *src, const SDL_Rect *dst,
+                         Uint32 depth) {
+    if (!texture) {
+        return;
+    }
+
+    Uint16 id = this->texture_id(texture);
+    const TextureInfo &info = this->textures[id];
+    SDL_Rect full_src{0, 0, info.w, info.h};
+    SDL_Rect full_dst{0, 0, this->output_w, this->output_h};
+
+    this->push_entry(layer, id, depth);
+    this->commands.push_back(
+        {texture, src ? *src : full_src, dst ? *dst : full_dst, 0, 0, 0, 0});
+}
+
+// The shape is copied into the queue, so the caller may reuse its buffers
+// straight away. Indices are relative to the shape's own vertices.
+void RenderQueue::submit_shape(Uint8 layer,
+                               std::span<const SDL_Vertex> vertices,
+                               std::span<const int> indices, Uint32 depth) {
+    if (indices.empty()) {
+        return;
+    }
+
+    this->push_entry(layer, this->texture_id(nullptr), depth);
+    this->commands.push_back(
+        {nullptr, {}, {},
+         static_cast<Uint32>(this->shape_vertices.size()),
+         static_cast<Uint32>(vertices.size()),
+         static_cast<Uint32>(this->shape_indices.size()),
+         static_cast<Uint32>(indices.size())});
+    this->shape_vertices.insert(this->shape_vertices.end(), vertices.begin(),
+                                vertices.end());
+    this->shape_indices.insert(this->shape_indices.end(), indices.begin(),
+                               indices.end());
+}
+
+void RenderQueue::push_entry(Uint8 layer, Uint16 id, Uint32 depth) {
+    Uint64 key = (Uint64{layer} << 56) | (Uint64{id} << 40) |
+                 (Uint64{depth} << 8);
+    this->entries.push_back({key, static_cast<Uint32>(this->commands.size())});
+}
+
+// LSD radix sort, one byte per pass. Passes where every key has the same
+// byte are skipped, which is most of them for typical keys.
+void RenderQueue::sort() {
+    auto start = std::chrono::steady_clock::now();
+    std::size_t n = this->entries.size();
+    this->scratch.resize(n);
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        std::array<std::size_t, 256> counts{};
+        for (const auto &entry : this->entries) {
+            counts[(entry.key >> shift) & 0xff]++;
+        }
+        if (n == 0 || counts[(this->entries[0].key >> shift) & 0xff] == n) {
+            continue;
+        }
+
+        std::size_t offset = 0;
+        for (auto &count : counts) {
+            std::size_t c = count;
+            count = offset;
+            offset += c;
+        }
+        for (const auto &entry : this->entries) {
+            this->scratch[counts[(entry.key >> shift) & 0xff]++] = entry;
+        }
+        this->entries.swap(this->scratch);
+    }
+
+    this->totals.sort_ms += std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
+}
+
+void RenderQueue::submit_run(SDL_Renderer *renderer, const TextureInfo &info) {
+    if (this->indices.empty()) {
+        return;
+    }
+    if (!info.texture) {
+        SDL_SetRenderDrawBlendMode(renderer, info.blend);
+    }
+    SDL_RenderGeometry(renderer, info.texture, this->vertices.data(),
+                       static_cast<int>(this->vertices.size()),
+                       this->indices.data(),
+                       static_cast<int>(this->indices.size()));
+    this->frame_draw_calls++;
+    this->vertices.clear();
+    this->indices.clear();
+}
+
+void RenderQueue::flush(SDL_Renderer *renderer) {
+    const TextureInfo *current = nullptr;
+    SDL_BlendMode blend = SDL_BLENDMODE_NONE;
+    SDL_Color white{255, 255, 255, 255};
+
+    for (const auto &entry : this->entries) {
+        const Command &cmd = this->commands[entry.index];
+        const TextureInfo &info = this->textures[(entry.key >> 40) & 0xffff];
+
+        if (&info != current) {
+            if (current) {
+                this->submit_run(renderer, *current);
+                this->totals.texture_changes++;
+                if (info.blend != blend) {
+                    this->totals.blend_changes++;
+                }
+            }
+            current = &info;
+            blend = info.blend;
+        }
+
+        if (!cmd.texture) {
+            int base = static_cast<int>(this->vertices.size());
+            auto first = this->shape_vertices.begin() + cmd.first_vertex;
+            this->vertices.insert(this->vertices.end(), first,
+                                  first + cmd.vertex_count);
+            const int *shape = this->shape_indices.data() + cmd.first_index;
+            for (Uint32 i = 0; i < cmd.index_count; i++) {
+                this->indices.push_back(base + shape[i]);
+            }
+            continue;
+        }
+
+        float tex_w = static_cast<float>(info.w);
+        float tex_h = static_cast<float>(info.h);
+        float u0 = cmd.src.x / tex_w;
+        float v0 = cmd.src.y / tex_h;
+        float u1 = (cmd.src.x + cmd.src.w) / tex_w;
+        float v1 = (cmd.src.y + cmd.src.h) / tex_h;
+        float x0 = static_cast<float>(cmd.dst.x);
+        float y0 = static_cast<float>(cmd.dst.y);
+        float x1 = static_cast<float>(cmd.dst.x + cmd.dst.w);
+        float y1 = static_cast<float>(cmd.dst.y + cmd.dst.h);
+
+        int base = static_cast<int>(this->vertices.size());
+        this->vertices.push_back({{x0, y0}, white, {u0, v0}});
+        this->vertices.push_back({{x1, y0}, white, {u1, v0}});
+        this->vertices.push_back({{x1, y1}, white, {u1, v1}});
+        this->vertices.push_back({{x0, y1}, white, {u0, v1}});
+        for (int i : {0, 1, 2, 0, 2, 3}) {
+            this->indices.push_back(base + i);
+        }
+    }
+    if (current) {
+        this->submit_run(renderer, *current);
+    }
+
+    this->finish();
+}
+
+void RenderQueue::flush(SoftRenderer &soft) {
+    for (const auto &entry : this->entries) {
+        const Command &cmd = this->commands[entry.index];
+        if (cmd.texture) {
+            soft.copy(cmd.texture, &cmd.src, &cmd.dst);
+            continue;
+        }
+        soft.fill({this->shape_vertices.data() + cmd.first_vertex,
+                   cmd.vertex_count},
+                  {this->shape_indices.data() + cmd.first_index,
+                   cmd.index_count});
+    }
+    this->finish();
+}
+
+void RenderQueue::finish() {
+    this->totals.frames++;
+    this->totals.commands += this->commands.size();
+    this->totals.draw_calls += this->frame_draw_calls;
+    this->frame_draw_calls = 0;
+    this->textures.clear();
+    this->commands.clear();
+    this->entries.clear();
+    this->shape_vertices.clear();
+    this->shape_indices.clear();
+}
+
+// Printable ASCII rendered once into one surface, so text can be drawn as
+// copies from a single texture through the render queue instead of
+// rendering a new surface each time it changes.
+class GlyphAtlas {
+  public:
+    GlyphAtlas();
+
+    SurfacePtr build(TTF_Font *font, SDL_Color color);
+    void set_texture(TexturePtr atlas) { this->texture = std::move(atlas); }
+    bool ready() const { return this->texture != nullptr; }
+    int line_height() const { return this->height; }
+
+    int draw(RenderQueue &queue, Uint8 layer, int x, int y,
+             std::string_view str) const;
+
+  private:
+    static constexpr char first{32};
+    static constexpr char last{126};
+    static constexpr int columns{16};
+
+    struct Glyph {
+        SDL_Rect src;
+        int advance;
+    };
+
+    std::array<Glyph, last - first + 1> glyphs;
+    int height;
+    TexturePtr texture;
+};
+
+GlyphAtlas::GlyphAtlas() : glyphs{}, height{0}, texture{nullptr} {}
+
+SurfacePtr GlyphAtlas::build(TTF_Font *font, SDL_Color color) {
+    this->height = TTF_FontHeight(font);
+
+    std::array<SurfacePtr, last - first + 1> rendered;
+    int cell_w = 1;
+    for (char ch = first; ch <= last; ch++) {
+        auto &surf = rendered[ch - first];
+        surf.reset(resources.track(TTF_RenderGlyph_Blended(font, ch, color)));
+        int advance = 0;
+        TTF_GlyphMetrics(font, ch, nullptr, nullptr, nullptr, nullptr,
+                         &advance);
+        this->glyphs[ch - first].advance = advance;
+        if (surf) {
+            cell_w = std::max(cell_w, surf->w);
+        }
+    }
+
+    int rows = (last - first + columns) / columns;
+    SurfacePtr atlas{resources.track(SDL_CreateRGBSurfaceWithFormat(
+        0, cell_w * columns, this->height * rows, 32,
+        SDL_PIXELFORMAT_ARGB8888))};
+    if (!atlas) {
+        auto error = std::format("Error creating Surface: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+
+    for (int i = 0; i <= last - first; i++) {
+        SDL_Rect cell{(i % columns) * cell_w, (i / columns) * this->height, 0,
+                      0};
+        if (rendered[i]) {
+            cell.w = rendered[i]->w;
+            cell.h = std::min(rendered[i]->h, this->height);
+            SDL_SetSurfaceBlendMode(rendered[i].get(), SDL_BLENDMODE_NONE);
+            SDL_BlitSurface(rendered[i].get(), nullptr, atlas.get(), &cell);
+        }
+        this->glyphs[i].src = cell;
+    }
+
+    return atlas;
+}
+
+// Submits one copy per glyph and returns the x after the last one. Bytes
+// outside printable ASCII are skipped.
+int GlyphAtlas::draw(RenderQueue &queue, Uint8 layer, int x, int y,
+                     std::string_view str) const {
+    for (char ch : str) {
+        if (ch < first || ch > last) {
+            continue;
+        }
+        const Glyph &glyph = this->glyphs[ch - first];
+        if (glyph.src.w > 0) {
+            SDL_Rect dst{x, y, glyph.src.w, glyph.src.h};
+            queue.submit(layer, this->texture.get(), &glyph.src, &dst);
+        }
+        x += glyph.advance;
+    }
+    return x;
+}
+
+// Decodes the UTF-8 sequence at str[pos] and moves pos past it. Malformed
+// bytes, and codepoints past the Basic Multilingual Plane that SDL_ttf's
+// 16-bit glyph calls cannot take, come back as '?'.
+Uint16 next_codepoint(std::string_view str, std::size_t &pos) {
+    auto byte = static_cast<unsigned char>(str[pos++]);
+    int extra;
+    if (byte < 0x80) {
+        return byte;
+    } else if ((byte & 0xe0) == 0xc0) {
+        extra = 1;
+    } else if ((byte & 0xf0) == 0xe0) {
+        extra = 2;
+    } else if ((byte & 0xf8) == 0xf0) {
+        extra = 3;
+    } else {
+        return '?';
+    }
+
+    Uint32 codepoint = byte & (0x3f >> extra);
+    for (int i = 0; i < extra; i++) {
+        auto next = static_cast<unsigned char>(pos < str.size() ? str[pos] : 0);
+        if ((next & 0xc0) != 0x80) {
+            return '?';
+        }
+        codepoint = codepoint << 6 | (next & 0x3f);
+        pos++;
+    }
+    return codepoint > 0xffff ? '?' : static_cast<Uint16>(codepoint);
+}
+
+struct FontStats {
+    std::size_t opens{0};
+    std::size_t page_hits{0};
+    std::size_t page_misses{0};
+    std::size_t page_evictions{0};
+    std::size_t layout_hits{0};
+    std::size_t layout_misses{0};
+};
+
+// Keeps one copy of the TTF file and opens each size from it the first
+// time that size is asked for. Advances and kerning are asked of FreeType
+// once per glyph and pair and kept. Glyphs are rendered white in pages of
+// page_glyphs codepoints per size. Pages are kept most recently used first
+// and the oldest are dropped once their surfaces pass the byte budget.
+// Layouts of strings drawn before are cached as well, so redrawing the
+// same text only blits. Returned references last until the next call.
+class FontManager {
+  public:
+    static constexpr int page_glyphs{128};
+
+    struct Glyph {
+        SDL_Rect src;
+        int advance;
+    };
+
+    struct Page {
+        SurfacePtr surface;
+        std::array<Glyph, page_glyphs> glyphs;
+    };
+
+    struct Layout {
+        std::string str;
+        int size;
+        std::vector<Uint16> codepoints;
+        std::vector<int> x;
+        int w;
+        int h;
+    };
+
+    explicit FontManager(std::size_t budget_bytes);
+
+    bool load(std::vector<char> bytes, int size);
+    TTF_Font *font(int size);
+    int advance(int size, Uint16 codepoint);
+    int kerning(int size, Uint16 left, Uint16 right);
+    const Page &page(int size, Uint16 codepoint);
+    const Layout &layout(int size, std::string_view str);
+    SurfacePtr render(int size, std::string_view str, SDL_Color color);
+
+    std::size_t page_bytes() const { return this->cached_bytes; }
+    const FontStats &stats() const { return this->counters; }
+    void report() const;
+
+  private:
+    using PageKey = std::pair<int, int>;
+
+    struct PageEntry {
+        Page page;
+        std::size_t bytes;
+        std::list<PageKey>::iterator order;
+    };
+
+    struct LayoutEntry {
+        Layout layout;
+        std::list<std::size_t>::iterator order;
+    };
+
+    static constexpr std::size_t layout_capacity{256};
+
+    TTF_Font *open(const std::vector<char> &bytes, int size) const;
+    Page build_page(TTF_Font *font, int index) const;
+
+    std::vector<char> data;
+    std::size_t budget;
+    std::map<int, FontPtr> fonts;
+    std::unordered_map<Uint32, int> advances;
+    std::unordered_map<Uint64, int> kerning_pairs;
+    std::map<PageKey, PageEntry> pages;
+    std::list<PageKey> page_order;
+    std::size_t cached_bytes;
+    std::unordered_map<std::size_t, LayoutEntry> layouts;
+    std::list<std::size_t> layout_order;
+    FontStats counters;
+};
+
+FontManager::FontManager(std::size_t budget_bytes)
+    : data{}, budget{budget_bytes}, fonts{}, advances{}, kerning_pairs{},
+      pages{}, page_order{},
+      cached_bytes{0}, layouts{}, layout_order{}, counters{} {}
+
+// Only the first size opened from a file is charged for it, since every
+// size reads the same bytes.
+TTF_Font *FontManager::open(const std::vector<char> &bytes, int size) const {
+    return resources.track(
+        TTF_OpenFontRW(
+            SDL_RWFromConstMem(bytes.data(), static_cast<int>(bytes.size())),
+            1, size),
+        this->fonts.empty() ? bytes.size() : 0);
+}
+
+// Swaps in a new font file, opening it at size to check it first. On
+// failure the old file and everything made from it stay.
+bool FontManager::load(std::vector<char> bytes, int size) {
+    std::map<int, FontPtr> old_fonts = std::move(this->fonts);
+    this->fonts.clear();
+    FontPtr probe{this->open(bytes, size)};
+    if (!probe) {
+        this->fonts = std::move(old_fonts);
+        return false;
+    }
+
+    // Fonts read the old bytes until they are closed, so they go first.
+    old_fonts.clear();
+    this->advances.clear();
+    this->kerning_pairs.clear();
+    this->pages.clear();
+    this->page_order.clear();
+    this->cached_bytes = 0;
+    this->layouts.clear();
+    this->layout_order.clear();
+    this->data = std::move(bytes);
+    this->fonts.emplace(size, std::move(probe));
+    this->counters.opens++;
+    return true;
+}
+
+TTF_Font *FontManager::font(int size) {
+    auto [it, inserted] = this->fonts.try_emplace(size, nullptr);
+    if (inserted) {
+        it->second.reset(this->open(this->data, size));
+        if (!it->second) {
+            this->fonts.erase(it);
+            auto error = std::format("Error creating Font: {}", TTF_GetError());
+            throw std::runtime_error(error);
+        }
+        this->counters.opens++;
+    }
+    return it->second.get();
+}
+
+int FontManager::advance(int size, Uint16 codepoint) {
+    auto key = static_cast<Uint32>(size) << 16 | codepoint;
+    auto [it, inserted] = this->advances.try_emplace(key, 0);
+    if (inserted) {
+        TTF_GlyphMetrics(this->font(size), codepoint, nullptr, nullptr,
+                         nullptr, nullptr, &it->second);
+    }
+    return it->second;
+}
+
+int FontManager::kerning(int size, Uint16 left, Uint16 right) {
+    auto key = static_cast<Uint64>(size) << 32 |
+               static_cast<Uint64>(left) << 16 | right;
+    auto [it, inserted] = this->kerning_pairs.try_emplace(key, 0);
+    if (inserted) {
+        it->second =
+            TTF_GetFontKerningSizeGlyphs(this->font(size), left, right);
+    }
+    return it->second;
+}
+
+FontManager::Page FontManager::build_page(TTF_Font *font, int index) const {
+    constexpr int columns{16};
+    constexpr SDL_Color white{255, 255, 255, 255};
+    int height = TTF_FontHeight(font);
+
+    Page page{nullptr, {}};
+    std::array<SurfacePtr, page_glyphs> rendered;
+    int cell_w = 1;
+    for (int i = 0; i < page_glyphs; i++) {
+        auto codepoint = static_cast<Uint16>(index * page_glyphs + i);
+        if (codepoint < ' ') {
+            continue;
+        }
+        rendered[i].reset(resources.track(
+            TTF_RenderGlyph_Blended(font, codepoint, white)));
+        TTF_GlyphMetrics(font, codepoint, nullptr, nullptr, nullptr, nullptr,
+                         &page.glyphs[i].advance);
+        if (rendered[i]) {
+            cell_w = std::max(cell_w, rendered[i]->w);
+        }
+    }
+
+    page.surface.reset(resources.track(SDL_CreateRGBSurfaceWithFormat(
+        0, cell_w * columns, height * (page_glyphs / columns), 32,
+        SDL_PIXELFORMAT_ARGB8888)));
+    if (!page.surface) {
+        auto error = std::format("Error creating Surface: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+
+    for (int i = 0; i < page_glyphs; i++) {
+        SDL_Rect cell{(i % columns) * cell_w, (i / columns) * height, 0, 0};
+        if (rendered[i]) {
+            cell.w = rendered[i]->w;
+            cell.h = std::min(rendered[i]->h, height);
+            SDL_SetSurfaceBlendMode(rendered[i].get(), SDL_BLENDMODE_NONE);
+            SDL_BlitSurface(rendered[i].get(), nullptr, page.surface.get(),
+                            &cell);
+        }
+        page.glyphs[i].src = cell;
+    }
+
+    return page;
+}
+
+const FontManager::Page &FontManager::page(int size, Uint16 codepoint) {
+    PageKey key{size, codepoint / page_glyphs};
+    auto it = this->pages.find(key);
+    if (it != this->pages.end()) {
+        this->counters.page_hits++;
+        this->page_order.splice(this->page_order.begin(), this->page_order,
+                                it->second.order);
+        return it->second.page;
+    }
+
+    this->counters.page_misses++;
+    Page page = this->build_page(this->font(size), key.second);
+    std::size_t bytes =
+        static_cast<std::size_t>(page.surface->pitch) * page.surface->h;
+    this->page_order.push_front(key);
+    it = this->pages
+             .emplace(key, PageEntry{std::move(page), bytes,
+                                     this->page_order.begin()})
+             .first;
+    this->cached_bytes += bytes;
+
+    // The page just made is never dropped, even when it alone is over.
+    while (this->cached_bytes > this->budget && this->page_order.size() > 1) {
+        auto oldest = this->pages.find(this->page_order.back());
+        this->cached_bytes -= oldest->second.bytes;
+        this->pages.erase(oldest);
+        this->page_order.pop_back();
+        this->counters.page_evictions++;
+    }
+
+    return it->second.page;
+}
+
+// Layouts are found by a hash of the size and string, and the stored
+// string is compared so a collision only costs a fresh layout.
+const FontManager::Layout &FontManager::layout(int size,
+                                               std::string_view str) {
+    std::size_t key =
+        std::hash<std::string_view>{}(str) ^ std::hash<int>{}(size) * 31;
+    auto it = this->layouts.find(key);
+    if (it != this->layouts.end() && it->second.layout.size == size &&
+        it->second.layout.str == str) {
+        this->counters.layout_hits++;
+        this->layout_order.splice(this->layout_order.begin(),
+                                  this->layout_order, it->second.order);
+        return it->second.layout;
+    }
+
+    this->counters.layout_misses++;
+    int height = TTF_FontHeight(this->font(size));
+    Layout layout{std::string{str}, size, {}, {}, 0, height};
+    int pen = 0;
+    Uint16 prev = 0;
+    for (std::size_t pos = 0; pos < str.size();) {
+        Uint16 codepoint = next_codepoint(str, pos);
+        if (prev) {
+            pen += this->kerning(size, prev, codepoint);
+        }
+        const Glyph &glyph =
+            this->page(size, codepoint).glyphs[codepoint % page_glyphs];
+        layout.codepoints.push_back(codepoint);
+        layout.x.push_back(pen);
+        layout.w = std::max(layout.w, pen + glyph.src.w);
+        pen += this->advance(size, codepoint);
+        prev = codepoint;
+    }
+    layout.w = std::max(layout.w, pen);
+
+    if (it != this->layouts.end()) {
+        it->second.layout = std::move(layout);
+        this->layout_order.splice(this->layout_order.begin(),
+                                  this->layout_order, it->second.order);
+        return it->second.layout;
+    }
+
+    if (this->layouts.size() >= layout_capacity) {
+        this->layouts.erase(this->layout_order.back());
+        this->layout_order.pop_back();
+    }
+    this->layout_order.push_front(key);
+    it = this->layouts
+             .emplace(key, LayoutEntry{std::move(layout),
+                                       this->layout_order.begin()})
+             .first;
+    return it->second.layout;
+}
+
+// Draws the string into a new surface by blitting its glyphs from the
+// pages. The surface starts as the text colour with zero alpha, so glyph
+// edges blend towards the colour rather than towards black.
+SurfacePtr FontManager::render(int size, std::string_view str,
+                               SDL_Color color) {
+    const Layout &layout = this->layout(size, str);
+    SurfacePtr surf{resources.track(SDL_CreateRGBSurfaceWithFormat(
+        0, std::max(1, layout.w), layout.h, 32, SDL_PIXELFORMAT_ARGB8888))};
+    if (!surf) {
+        auto error = std::format("Error creating Surface: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+    SDL_FillRect(surf.get(), nullptr,
+                 SDL_MapRGBA(surf->format, color.r, color.g, color.b, 0));
+
+    for (std::size_t i = 0; i < layout.codepoints.size(); i++) {
+        Uint16 codepoint = layout.codepoints[i];
+        const Page &page = this->page(size, codepoint);
+        SDL_Rect src = page.glyphs[codepoint % page_glyphs].src;
+        if (src.w == 0) {
+            continue;
+        }
+        SDL_Rect dst{layout.x[i], 0, src.w, src.h};
+        SDL_SetSurfaceColorMod(page.surface.get(), color.r, color.g, color.b);
+        SDL_SetSurfaceAlphaMod(page.surface.get(), color.a);
+        SDL_BlitSurface(page.surface.get(), &src, surf.get(), &dst);
+    }
+
+    return surf;
+}
+
+void FontManager::report() const {
+    auto rate = [](std::size_t hits, std::size_t misses) {
+        return hits + misses ? 100.0 * hits / (hits + misses) : 0.0;
+    };
+    const FontStats &stats = this->counters;
+    std::cout << std::format(
+        "Fonts: {} sizes open ({} opens) from {:.0f} KiB\n",
+        this->fonts.size(), stats.opens, this->data.size() / 1024.0);
+    std::cout << std::format(
+        "Glyph pages: {:.1f}% hits ({} misses, {} evicted) {} pages "
+        "{:.0f}/{:.0f} KiB\n",
+        rate(stats.page_hits, stats.page_misses), stats.page_misses,
+        stats.page_evictions, this->pages.size(), this->cached_bytes / 1024.0,
+        this->budget / 1024.0);
+    std::cout << std::format("Text layouts: {:.1f}% hits ({} misses) {} kept\n",
+                             rate(stats.layout_hits, stats.layout_misses),
+                             stats.layout_misses, this->layouts.size());
+}
+
+enum class Align { Left, Center, Right };
+
+// Wrapped, aligned paragraphs drawn from a FontManager's glyph pages. The
+// text is split into paragraphs at newlines and each is broken into lines
+// at spaces, or mid-word when one word is wider than the layout. Breaks are
+// cached by paragraph, width and font size, so repeated paragraphs and
+// going back to an earlier width only cost a lookup. Appending lays out
+// just the paragraphs the new text touches.
+class TextLayout {
+  public:
+    struct Line {
+        std::size_t begin;
+        std::size_t end;
+        int width;
+    };
+
+    TextLayout(FontManager &fonts, int size, int width, Align align);
+
+    void set_text(std::string_view str);
+    void append(std::string_view str);
+    void set_width(int width);
+
+    const std::vector<Line> &lines() const { return this->line_list; }
+    int line_height();
+    std::size_t break_hits() const { return this->hits; }
+    std::size_t break_misses() const { return this->misses; }
+
+    void draw(SDL_Surface *target, int x, int y, std::size_t first,
+              std::size_t count, SDL_Color color);
+    SurfacePtr render(SDL_Color color);
+
+  private:
+    struct Break {
+        Uint32 begin;
+        Uint32 end;
+        int width;
+    };
+
+    struct CachedBreaks {
+        std::string paragraph;
+        int size;
+        int width;
+        std::vector<Break> breaks;
+    };
+
+    static constexpr std::size_t cache_capacity{1 << 15};
+
+    void layout_from(std::size_t begin);
+    const std::vector<Break> &break_paragraph(std::string_view paragraph);
+
+    FontManager &fonts;
+    int size;
+    int wrap_width;
+    Align align;
+    std::string text;
+    std::size_t last_paragraph;
+    std::size_t last_paragraph_line;
+    std::vector<Line> line_list;
+    std::unordered_map<std::size_t, CachedBreaks> break_cache;
+    std::size_t hits;
+    std::size_t misses;
+};
+
+TextLayout::TextLayout(FontManager &fonts, int size, int width, Align align)
+    : fonts{fonts}, size{size}, wrap_width{width}, align{align}, text{},
+      last_paragraph{0}, last_paragraph_line{0}, line_list{}, break_cache{},
+      hits{0}, misses{0} {}
+
+void TextLayout::set_text(std::string_view str) {
+    this->text.assign(str);
+    this->line_list.clear();
+    this->layout_from(0);
+}
+
+// The last paragraph is the only one the new text can change, so its
+// lines are dropped and it is laid out again along with any new ones.
+void TextLayout::append(std::string_view str) {
+    this->text.append(str);
+    this->line_list.resize(this->last_paragraph_line);
+    this->layout_from(this->last_paragraph);
+}
+
+void TextLayout::set_width(int width) {
+    if (width != this->wrap_width) {
+        this->wrap_width = width;
+        this->line_list.clear();
+        this->layout_from(0);
+    }
+}
+
+int TextLayout::line_height() {
+    return TTF_FontLineSkip(this->fonts.font(this->size));
+}
+
+void TextLayout::layout_from(std::size_t begin) {
+    while (true) {
+        std::size_t end = this->text.find('\n', begin);
+        if (end == std::string::npos) {
+            end = this->text.size();
+        }
+        this->last_paragraph = begin;
+        this->last_paragraph_line = this->line_list.size();
+
+        std::string_view paragraph{this->text.data() + begin, end - begin};
+        for (const Break &brk : this->break_paragraph(paragraph)) {
+            this->line_list.push_back(
+                {begin + brk.begin, begin + brk.end, brk.width});
+        }
+
+        if (end == this->text.size()) {
+            return;
+        }
+        begin = end + 1;
+    }
+}
+
+// A line that wraps at a space ends before the run of spaces and the next
+// one starts after it. Widths include kerning between neighbours.
+const std::vector<TextLayout::Break> &
+TextLayout::break_paragraph(std::string_view paragraph) {
+    std::size_t key = std::hash<std::string_view>{}(paragraph) ^
+                      std::hash<int>{}(this->wrap_width << 8 ^ this->size);
+    auto it = this->break_cache.find(key);
+    if (it != this->break_cache.end() && it->second.size == this->size &&
+        it->second.width == this->wrap_width &&
+        it->second.paragraph == paragraph) {
+        this->hits++;
+        return it->second.breaks;
+    }
+    this->misses++;
+
+    // Cached breaks only save time, so the cache is simply emptied when
+    // it fills up.
+    if (it == this->break_cache.end() &&
+        this->break_cache.size() >= cache_capacity) {
+        this->break_cache.clear();
+    }
+    CachedBreaks &entry = this->break_cache[key];
+    entry.paragraph.assign(paragraph);
+    entry.size = this->size;
+    entry.width = this->wrap_width;
+    entry.breaks.clear();
+
+    constexpr std::size_t none = std::string_view::npos;
+    std::size_t line_begin = 0;
+    std::size_t space_begin = none;
+    std::size_t space_end = 0;
+    int space_begin_pen = 0;
+    int space_end_pen = 0;
+    int pen = 0;
+    Uint16 prev = 0;
+    for (std::size_t pos = 0; pos < paragraph.size();) {
+        std::size_t start = pos;
+        Uint16 codepoint = next_codepoint(paragraph, pos);
+        int kern = prev ? this->fonts.kerning(this->size, prev, codepoint) : 0;
+        int advance = this->fonts.advance(this->size, codepoint);
+
+        if (codepoint == ' ') {
+            if (prev != ' ') {
+                space_begin = start;
+                space_begin_pen = pen;
+            }
+            pen += kern + advance;
+            space_end = pos;
+            space_end_pen = pen;
+            prev = codepoint;
+            continue;
+        }
+
+        if (pen + kern + advance > this->wrap_width && start > line_begin) {
+            if (space_begin != none && space_begin > line_begin) {
+                entry.breaks.push_back(
+                    {static_cast<Uint32>(line_begin),
+                     static_cast<Uint32>(space_begin), space_begin_pen});
+                line_begin = space_end;
+                pen -= space_end_pen;
+            } else {
+                entry.breaks.push_back({static_cast<Uint32>(line_begin),
+                                        static_cast<Uint32>(start), pen});
+                line_begin = start;
+                pen = 0;
+            }
+            // Lines are drawn without kerning against the line before.
+            kern = 0;
+            space_begin = none;
+        }
+        pen += kern + advance;
+        prev = codepoint;
+    }
+
+    if (prev == ' ' && space_begin != none && space_begin > line_begin) {
+        entry.breaks.push_back({static_cast<Uint32>(line_begin),
+                                static_cast<Uint32>(space_begin),
+                                space_begin_pen});
+    } else {
+        entry.breaks.push_back({static_cast<Uint32>(line_begin),
+                                static_cast<Uint32>(paragraph.size()), pen});
+    }
+    return entry.breaks;
+}
+
+// Draws count lines from first, the top of the first at y, aligned within
+// the layout width starting at x.
+void TextLayout::draw(SDL_Surface *target, int x, int y, std::size_t first,
+                      std::size_t count, SDL_Color color) {
+    int line_height = this->line_height();
+    std::size_t last = std::min(this->line_list.size(), first + count);
+    for (std::size_t i = first; i < last; i++, y += line_height) {
+        const Line &line = this->line_list[i];
+        int pen = x;
+        if (this->align == Align::Center) {
+            pen += (this->wrap_width - line.width) / 2;
+        } else if (this->align == Align::Right) {
+            pen += this->wrap_width - line.width;
+        }
+
+        std::string_view str{this->text.data(), line.end};
+        Uint16 prev = 0;
+        for (std::size_t pos = line.begin; pos < line.end;) {
+            Uint16 codepoint = next_codepoint(str, pos);
+            if (prev) {
+                pen += this->fonts.kerning(this->size, prev, codepoint);
+            }
+            const FontManager::Page &page =
+                this->fonts.page(this->size, codepoint);
+            SDL_Rect src =
+                page.glyphs[codepoint % FontManager::page_glyphs].src;
+            if (src.w > 0) {
+                SDL_Rect dst{pen, y, src.w, src.h};
+                SDL_SetSurfaceColorMod(page.surface.get(), color.r, color.g,
+                                       color.b);
+                SDL_SetSurfaceAlphaMod(page.surface.get(), color.a);
+                SDL_BlitSurface(page.surface.get(), &src, target, &dst);
+            }
+            pen += this->fonts.advance(this->size, codepoint);
+            prev = codepoint;
+        }
+    }
+}
+
+// Draws every line into a new surface as wide as the widest line, or the
+// layout width when aligned to the centre or right.
+SurfacePtr TextLayout::render(SDL_Color color) {
+    int w = 1;
+    for (const Line &line : this->line_list) {
+        w = std::max(w, line.width);
+    }
+    if (this->align != Align::Left) {
+        w = std::max(w, this->wrap_width);
+    }
+    int h = this->line_height() * static_cast<int>(this->line_list.size());
+
+    SurfacePtr surf{resources.track(SDL_CreateRGBSurfaceWithFormat(
+        0, w, std::max(1, h), 32, SDL_PIXELFORMAT_ARGB8888))};
+    if (!surf) {
+        auto error = std::format("Error creating Surface: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+    SDL_FillRect(surf.get(), nullptr,
+                 SDL_MapRGBA(surf->format, color.r, color.g, color.b, 0));
+    this->draw(surf.get(), 0, 0, 0, this->line_list.size(), color);
+    return surf;
+}
+
+// Performance overlay: a few lines of timing and resource figures drawn
+// from a GlyphAtlas, and a bar graph of the last history_size frame times.
+// It times its own work so its cost can be reported separately.
+class PerfHud {
+  public:
+    static constexpr std::size_t history_size{300};
+    static constexpr int graph_height{100};
+
+    PerfHud();
+
+    void record(float frame_ms, float update_ms, float render_ms);
+    void submit(RenderQueue &queue, Uint8 layer, const GlyphAtlas &atlas,
+                std::pmr::memory_resource &arena, int x, int y,
+                std::size_t draw_calls, std::size_t texture_bytes,
+                int channels);
+    void submit_graph(RenderQueue &queue, Uint8 layer, int x, int y,
+                      float budget_ms);
+
+    std::size_t frames() const { return this->cost_frames; }
+    double cost_ms() const { return this->cost.count(); }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    std::array<float, history_size> history;
+    std::size_t next;
+    std::size_t count;
+    float update_ms;
+    float render_ms;
+    // One quad per bar plus one for the budget line.
+    std::array<SDL_Vertex, (history_size + 1) * 4> graph_vertices;
+    std::array<int, (history_size + 1) * 6> graph_indices;
+    std::chrono::duration<double, std::milli> cost;
+    std::size_t cost_frames;
+    float last_cost_ms;
+    float frame_cost_ms;
+};
+
+PerfHud::PerfHud()
+    : history{}, next{0}, count{0}, update_ms{0.0f}, render_ms{0.0f},
+      graph_vertices{}, graph_indices{}, cost{0}, cost_frames{0},
+      last_cost_ms{0.0f}, frame_cost_ms{0.0f} {
+    for (std::size_t i = 0; i <= history_size; i++) {
+        int base = static_cast<int>(i * 4);
+        int *quad = this->graph_indices.data() + i * 6;
+        quad[0] = base;
+        quad[1] = base + 1;
+        quad[2] = base + 2;
+        quad[3] = base;
+        quad[4] = base + 2;
+        quad[5] = base + 3;
+    }
+}
+
+void PerfHud::record(float frame_ms, float update_ms, float render_ms) {
+    this->history[this->next] = frame_ms;
+    this->next = (this->next + 1) % history_size;
+    this->count = std::min(this->count + 1, history_size);
+    this->update_ms = update_ms;
+    this->render_ms = render_ms;
+    this->last_cost_ms = this->frame_cost_ms;
+    this->frame_cost_ms = 0.0f;
+}
+
+// The lines are formatted into a string on the frame arena, so drawing the
+// HUD does not touch the heap.
+void PerfHud::submit(RenderQueue &queue, Uint8 layer, const GlyphAtlas &atlas,
+                     std::pmr::memory_resource &arena, int x, int y,
+                     std::size_t draw_calls, std::size_t texture_bytes,
+                     int channels) {
+    auto start = Clock::now();
+
+    float sum = 0.0f;
+    float worst = 0.0f;
+    for (std::size_t i = 0; i < this->count; i++) {
+        sum += this->history[i];
+        worst = std::max(worst, this->history[i]);
+    }
+    float frame_ms = this->count ? sum / this->count : 0.0f;
+
+    std::pmr::string line{&arena};
+    line.reserve(64);
+    auto print = [&]() {
+        atlas.draw(queue, layer, x, y, line);
+        y += atlas.line_height();
+        line.clear();
+    };
+    auto out = std::back_inserter(line);
+    std::format_to(out, "frame {:.2f} ms avg {:.2f} max", frame_ms, worst);
+    print();
+    std::format_to(out, "update {:.2f} ms render {:.2f} ms", this->update_ms,
+                   this->render_ms);
+    print();
+    std::format_to(out, "draw calls {} textures {:.0f} KiB", draw_calls,
+                   texture_bytes / 1024.0);
+    print();
+    std::format_to(out, "mixer channels {}", channels);
+    print();
+    std::format_to(out, "hud {:.3f} ms", this->last_cost_ms);
+    print();
+
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    this->cost += elapsed;
+    this->cost_frames++;
+    this->frame_cost_ms += static_cast<float>(elapsed.count());
+}
+
+// Queues the bars oldest first, with the bottom at y, and a line across at
+// the frame budget, as one shape.
+void PerfHud::submit_graph(RenderQueue &queue, Uint8 layer, int x, int y,
+                           float budget_ms) {
+    auto start = Clock::now();
+
+    constexpr float px_per_ms = 3.0f;
+    auto quad = [this](std::size_t i, float x0, float y0, float x1, float y1,
+                       SDL_Color c) {
+        SDL_Vertex *v = this->graph_vertices.data() + i * 4;
+        v[0] = {{x0, y0}, c, {0.0f, 0.0f}};
+        v[1] = {{x1, y0}, c, {0.0f, 0.0f}};
+        v[2] = {{x1, y1}, c, {0.0f, 0.0f}};
+        v[3] = {{x0, y1}, c, {0.0f, 0.0f}};
+    };
+
+    std::size_t oldest = (this->next + history_size - this->count) %
+                         history_size;
+    float bottom = static_cast<float>(y);
+    for (std::size_t i = 0; i < this->count; i++) {
+        float ms = this->history[(oldest + i) % history_size];
+        int h = std::min(graph_height, static_cast<int>(ms * px_per_ms) + 1);
+        float left = static_cast<float>(x + static_cast<int>(i));
+        quad(i, left, bottom - h, left + 1.0f, bottom, {0, 255, 0, 192});
+    }
+    int budget_px = static_cast<int>(budget_ms * px_per_ms);
+    float budget_y = static_cast<float>(y - budget_px);
+    quad(this->count, static_cast<float>(x), budget_y,
+         static_cast<float>(x + static_cast<int>(history_size)),
+         budget_y + 1.0f, {255, 64, 64, 255});
+
+    std::size_t quads = this->count + 1;
+    queue.submit_shape(layer, {this->graph_vertices.data(), quads * 4},
+                       {this->graph_indices.data(), quads * 6});
+
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    this->cost += elapsed;
+    this->frame_cost_ms += static_cast<float>(elapsed.count());
+}
+
+// Settings read from a key = value file and then overridden by --key=value
+// command line arguments. A bare --key means --key=true, and dashes in keys
+// are read as underscores.
+struct Config {
+    std::string config_path{"game.cfg"};
+    std::string baseline{"bench_baseline.txt"};
+    int width{800};
+    int height{600};
+    RenderBackend renderer{RenderBackend::Accelerated};
+    bool audio_queue{true};
+    bool vsync{false};
+    int tick_rate{60};
+    int audio_buffer{1024};
+    int threads{0};
+    int font_size{80};
+    int text_speed{3};
+    int sprite_speed{300};
+    int sprite_damping{8};
+    int tile_size{50};
+    int map_width{0};
+    int map_height{0};
+    int particle_capacity{4096};
+    int particle_burst{64};
+    int live_particles{0};
+    int particle_chunk{16384};
+    int band_rows{32};
+    int frames{0};
+    int threshold{10};
+    int sessions{0};
+    int viewports{0};
+    int font_budget{4096};
+    bool headless{false};
+    bool update_baseline{false};
+    bool server{false};
+    bool server_render{false};
+    bool low_latency{false};
+    bool bench_kernels{false};
+    bool bench_streaming{false};
+    bool bench_particles{false};
+    bool bench_render_queue{false};
+    bool bench_sweep{false};
+    bool bench_snapshot{false};
+    bool bench_input{false};
+    bool bench_motion{false};
+    bool bench_text{false};
+    bool bench_mixer{false};
+    bool bench_map{false};
+    bool bench_pacing{false};
+
+    void set(std::string key, const std::string &value);
+    unsigned thread_count() const;
+    int map_tiles_x() const;
+    int map_tiles_y() const;
+    int world_width() const;
+    int world_height() const;
+};
+
+void Config::set(std::string key, const std::string &value) {
+    // Each integer setting with the smallest value it accepts. Sizes and
+    // rates need at least 1; a 0 elsewhere means none or the default.
+    struct IntSetting {
+        int Config::*field;
+        int min;
+    };
+    static const std::map<std::string, IntSetting> ints{
+        {"width", {&Config::width, 1}},
+        {"height", {&Config::height, 1}},
+        {"tick_rate", {&Config::tick_rate, 1}},
+        {"audio_buffer", {&Config::audio_buffer, 1}},
+        {"threads", {&Config::threads, 0}},
+        {"font_size", {&Config::font_size, 1}},
+        {"text_speed", {&Config::text_speed, 0}},
+        {"sprite_speed", {&Config::sprite_speed, 0}},
+        {"sprite_damping", {&Config::sprite_damping, 0}},
+        {"tile_size", {&Config::tile_size, 1}},
+        {"map_width", {&Config::map_width, 0}},
+        {"map_height", {&Config::map_height, 0}},
+        {"particle_capacity", {&Config::particle_capacity, 1}},
+        {"particle_burst", {&Config::particle_burst, 0}},
+        {"live_particles", {&Config::live_particles, 0}},
+        {"particle_chunk", {&Config::particle_chunk, 1}},
+        {"band_rows", {&Config::band_rows, 1}},
+        {"frames", {&Config::frames, 0}},
+        {"threshold", {&Config::threshold, 0}},
+        {"sessions", {&Config::sessions, 0}},
+        {"viewports", {&Config::viewports, 0}},
+        {"font_budget", {&Config::font_budget, 1}},
+    };
+    static const std::map<std::string, bool Config::*> flags{
+        {"audio_queue", &Config::audio_queue},
+        {"vsync", &Config::vsync},
+        {"headless", &Config::headless},
+        {"update_baseline", &Config::update_baseline},
+        {"server", &Config::server},
+        {"server_render", &Config::server_render},
+        {"low_latency", &Config::low_latency},
+        {"bench_kernels", &Config::bench_kernels},
+        {"bench_streaming", &Config::bench_streaming},
+        {"bench_particles", &Config::bench_particles},
+        {"bench_render_queue", &Config::bench_render_queue},
+        {"bench_sweep", &Config::bench_sweep},
+        {"bench_snapshot", &Config::bench_snapshot},
+        {"bench_input", &Config::bench_input},
+        {"bench_motion", &Config::bench_motion},
+        {"bench_text", &Config::bench_text},
+        {"bench_mixer", &Config::bench_mixer},
+        {"bench_map", &Config::bench_map},
+        {"bench_pacing", &Config::bench_pacing},
+    };
+
+    std::replace(key.begin(), key.end(), '-', '_');
+
+    if (key == "config") {
+        this->config_path = value;
+    } else if (key == "baseline") {
+        this->baseline = value;
+    } else if (key == "renderer") {
+        if (value == "accelerated") {
+            this->renderer = RenderBackend::Accelerated;
+        } else if (value == "sdl-software") {
+            this->renderer = RenderBackend::SdlSoftware;
+        } else if (value == "soft") {
+            this->renderer = RenderBackend::Soft;
+        } else {
+            auto error = std::format("Unknown renderer: {}", value);
+            throw std::runtime_error(error);
+        }
+    } else if (auto it = ints.find(key); it != ints.end()) {
+        int parsed;
+        auto [end, ec] = std::from_chars(value.data(),
+                                         value.data() + value.size(), parsed);
+        if (ec != std::errc{} || end != value.data() + value.size()) {
+            auto error = std::format("Invalid value for {}: {}", key, value);
+            throw std::runtime_error(error);
+        }
+        if (parsed < it->second.min) {
+            auto error = std::format("Invalid value for {}: {} (minimum {})",
+                                     key, value, it->second.min);
+            throw std::runtime_error(error);
+        }
+        // SDL_mixer takes its chunk size in sample frames as a power of two.
+        if (key == "audio_buffer" && (parsed & (parsed - 1)) != 0) {
+            auto error = std::format(
+                "Invalid value for {}: {} (must be a power of two)", key,
+                value);
+            throw std::runtime_error(error);
+        }
+        this->*(it->second.field) = parsed;
+    } else if (auto it = flags.find(key); it != flags.end()) {
+        if (value == "true" || value == "1" || value == "on") {
+            this->*(it->second) = true;
+        } else if (value == "false" || value == "0" || value == "off") {
+            this->*(it->second) = false;
+        } else {
+            auto error = std::format("Invalid value for {}: {}", key, value);
+            throw std::runtime_error(error);
+        }
+    } else {
+        auto error = std::format("Unknown setting: {}", key);
+        throw std::runtime_error(error);
+    }
+}
+
+unsigned Config::thread_count() const {
+    if (this->threads > 0) {
+        return static_cast<unsigned>(this->threads);
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// The map is map_width x map_height tiles, or just covers the window when
+// those are left at 0. The world is the map in pixels.
+int Config::map_tiles_x() const {
+    return this->map_width ? this->map_width
+                           : this->width / std::max(1, this->tile_size);
+}
+
+int Config::map_tiles_y() const {
+    return this->map_height ? this->map_height
+                            : this->height / std::max(1, this->tile_size);
+}
+
+int Config::world_width() const {
+    return this->map_tiles_x() * std::max(1, this->tile_size);
+}
+
+int Config::world_height() const {
+    return this->map_tiles_y() * std::max(1, this->tile_size);
+}
+
+std::pair<std::string, std::string> split_setting(const std::string &text) {
+    auto trim = [](std::string str) {
+        auto first = str.find_first_not_of(" \t\r");
+        auto last = str.find_last_not_of(" \t\r");
+        return first == std::string::npos
+                   ? std::string{}
+                   : str.substr(first, last - first + 1);
+    };
+
+    auto eq = text.find('=');
+    if (eq == std::string::npos) {
+        return {trim(text), "true"};
+    }
+    return {trim(text.substr(0, eq)), trim(text.substr(eq + 1))};
+}
+
+// Reads the config file, if there is one, then applies the command line.
+// The command line is scanned for --config first so it can pick the file.
+Config load_config(int argc, char *argv[]) {
+    Config config;
+    std::vector<std::pair<std::string, std::string>> overrides;
+    for (int i = 1; i < argc; i++) {
+        std::string arg{argv[i]};
+        if (!arg.starts_with("--")) {
+            auto error = std::format("Unknown argument: {}", arg);
+            throw std::runtime_error(error);
+        }
+        overrides.push_back(split_setting(arg.substr(2)));
+        if (overrides.back().first == "config") {
+            config.config_path = overrides.back().second;
+        }
+    }
+
+    std::ifstream file{config.config_path};
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        line = line.substr(0, line.find('#'));
+        auto [key, value] = split_setting(line);
+        if (key.empty()) {
+            continue;
+        }
+        try {
+            config.set(key, value);
+        } catch (const std::runtime_error &e) {
+            auto error = std::format("Error in {} line {}: {}",
+                                     config.config_path, number, e.what());
+            throw std::runtime_error(error);
+        }
+    }
+
+    for (const auto &[key, value] : overrides) {
+        config.set(key, value);
+    }
+
+    return config;
+}
+
+// Per-session game state and the fixed-step update that advances it. It
+// owns no SDL objects, so any number of sessions can run side by side
+// without a window or audio device. step() returns the number of wall
+// bounces so the caller can play sounds for them.
+class Simulation {
+  public:
+    struct Input {
+        float move_x{0.0f};
+        float move_y{0.0f};
+    };
+
+    explicit Simulation(const Config &config);
+
+    void set_text_size(int w, int h);
+    void set_sprite_size(int w, int h);
+    int step(const Input &input, SDL_Color burst_color);
+    void save(Snapshot &snapshot) const;
+    void restore(Snapshot &snapshot);
+
+    const SDL_Rect &text_rect() const { return this->text; }
+    const SDL_Rect &sprite_rect() const { return this->sprite; }
+    float sprite_speed() const { return this->motion.speed(this->player); }
+    std::span<const SDL_FPoint> bounces() const {
+        return {this->bounce_points.data(), this->bounce_count};
+    }
+    ParticleSystem &particles() { return this->particle_system; }
+    std::mt19937 &rng() { return this->gen; }
+
+  private:
+    int update_text(SDL_Color burst_color);
+    void update_sprite(const Input &input);
+
+    int width;
+    int height;
+    int burst;
+    std::size_t live_particles;
+    float dt;
+    SDL_Rect text;
+    int text_vel;
+    int text_xvel;
+    int text_yvel;
+    std::array<SDL_FPoint, 2> bounce_points;
+    std::size_t bounce_count;
+    SDL_Rect sprite;
+    MotionSystem motion;
+    std::size_t player;
+    std::mt19937 gen;
+    ParticleSystem particle_system;
+};
+
+Simulation::Simulation(const Config &config)
+    : width{config.world_width()}, height{config.world_height()},
+      burst{config.particle_burst},
+      live_particles{static_cast<std::size_t>(config.live_particles)},
+      dt{1.0f / std::max(1, config.tick_rate)}, text{0, 0, 0, 0},
+      text_vel{config.text_speed}, text_xvel{config.text_speed},
+      text_yvel{config.text_speed}, bounce_points{}, bounce_count{0},
+      sprite{0, 0, 0, 0},
+      motion{static_cast<float>(config.sprite_speed * config.sprite_damping),
+             static_cast<float>(config.sprite_damping)},
+      player{0}, gen{},
+      particle_system{static_cast<std::size_t>(config.particle_capacity),
+                      static_cast<std::size_t>(config.particle_chunk)} {
+    this->motion.set_bounds(static_cast<float>(this->width),
+                            static_cast<float>(this->height));
+    this->player = this->motion.add(0.0f, 0.0f);
+}
+
+void Simulation::set_text_size(int w, int h) {
+    this->text.w = w;
+    this->text.h = h;
+}
+
+void Simulation::set_sprite_size(int w, int h) {
+    this->motion.set_size(this->player, static_cast<float>(w),
+                          static_cast<float>(h));
+    this->sprite = this->motion.rect(this->player);
+}
+
+int Simulation::step(const Input &input, SDL_Color burst_color) {
+    int bounces = this->update_text(burst_color);
+    this->update_sprite(input);
+    return bounces;
+}
+
+int Simulation::update_text(SDL_Color burst_color) {
+    this->text.x += this->text_xvel;
+    this->text.y += this->text_yvel;
+
+    float center_x = this->text.x + this->text.w / 2.0f;
+    float center_y = this->text.y + this->text.h / 2.0f;
+    auto bounce = [this, burst_color](float x, float y) {
+        this->particle_system.burst(x, y, this->burst, burst_color, this->gen);
+        this->bounce_points[this->bounce_count++] = {x, y};
+    };
+
+    this->bounce_count = 0;
+    if (this->text.x < 0) {
+        this->text_xvel = this->text_vel;
+        bounce(0.0f, center_y);
+    } else if (this->text.x + this->text.w > this->width) {
+        this->text_xvel = -this->text_vel;
+        bounce(static_cast<float>(this->width), center_y);
+    }
+    if (this->text.y < 0) {
+        this->text_yvel = this->text_vel;
+        bounce(center_x, 0.0f);
+    } else if (this->text.y + this->text.h > this->height) {
+        this->text_yvel = -this->text_vel;
+        bounce(center_x, static_cast<float>(this->height));
+    }
+
+    // With live_particles set, the text sheds enough particles each tick to
+    // keep that many alive, so load does not hinge on how often it bounces.
+    std::size_t live = this->particle_system.size();
+    if (live < this->live_particles) {
+        this->particle_system.burst(center_x, center_y,
+                                    static_cast<int>(this->live_particles -
+                                                     live),
+                                    burst_color, this->gen);
+    }
+
+    this->particle_system.update(this->dt);
+    return static_cast<int>(this->bounce_count);
+}
+
+// The scalar state is written as one block. The RNG is copied as raw
+// memory, which is far cheaper than its text serialization.
+void Simulation::save(Snapshot &snapshot) const {
+    static_assert(std::is_trivially_copyable_v<std::mt19937>);
+    snapshot.write_value(this->text);
+    snapshot.write_value(std::array<int, 3>{this->text_vel, this->text_xvel,
+                                            this->text_yvel});
+    snapshot.write_value(this->gen);
+    this->motion.save(snapshot);
+    this->particle_system.save(snapshot);
+}
+
+void Simulation::restore(Snapshot &snapshot) {
+    std::array<int, 3> text_vels;
+    snapshot.read_value(this->text);
+    snapshot.read_value(text_vels);
+    snapshot.read_value(this->gen);
+    this->motion.restore(snapshot);
+    this->particle_system.restore(snapshot);
+    this->sprite = this->motion.rect(this->player);
+    this->text_vel = text_vels[0];
+    this->text_xvel = text_vels[1];
+    this->text_yvel = text_vels[2];
+}
+
+void Simulation::update_sprite(const Input &input) {
+    this->motion.steer(this->player, input.move_x, input.move_y);
+    this->motion.update(this->dt);
+    this->sprite = this->motion.rect(this->player);
+}
+
+// Things the player can do, from any mix of keyboard and controllers.
+enum class Action { Left, Right, Up, Down, Flash, ToggleMusic, Quit, Count };
+
+// Maps keyboard keys and game controller buttons and sticks to actions.
+// handle() records device state from each polled event, and update() folds
+// it into action states once per tick, so the game never looks at devices
+// directly. All state is in fixed arrays, so nothing allocates after
+// construction apart from SDL opening a newly plugged in controller.
+class InputMap {
+  public:
+    static constexpr std::size_t max_controllers{4};
+    static constexpr int dead_zone{8000};
+
+    InputMap();
+
+    void handle(const SDL_Event &event);
+    void update();
+
+    bool held(Action action) const;
+    bool pressed(Action action) const;
+    float axis_x() const { return this->move_x; }
+    float axis_y() const { return this->move_y; }
+    std::size_t controllers() const;
+
+  private:
+    using ControllerPtr = Handle<SDL_GameController, SDL_GameControllerClose>;
+
+    static constexpr auto action_count =
+        static_cast<std::size_t>(Action::Count);
+
+    struct KeyBinding {
+        SDL_Scancode key;
+        Action action;
+    };
+
+    struct ButtonBinding {
+        SDL_GameControllerButton button;
+        Action action;
+    };
+
+    struct Pad {
+        ControllerPtr controller;
+        SDL_JoystickID id;
+        std::bitset<SDL_CONTROLLER_BUTTON_MAX> buttons;
+        std::array<Sint16, SDL_CONTROLLER_AXIS_MAX> axes;
+    };
+
+    static constexpr std::array<KeyBinding, 11> key_bindings{{
+        {SDL_SCANCODE_LEFT, Action::Left},
+        {SDL_SCANCODE_A, Action::Left},
+        {SDL_SCANCODE_RIGHT, Action::Right},
+        {SDL_SCANCODE_D, Action::Right},
+        {SDL_SCANCODE_UP, Action::Up},
+        {SDL_SCANCODE_W, Action::Up},
+        {SDL_SCANCODE_DOWN, Action::Down},
+        {SDL_SCANCODE_S, Action::Down},
+        {SDL_SCANCODE_SPACE, Action::Flash},
+        {SDL_SCANCODE_M, Action::ToggleMusic},
+        {SDL_SCANCODE_ESCAPE, Action::Quit},
+    }};
+
+    static constexpr std::array<ButtonBinding, 7> button_bindings{{
+        {SDL_CONTROLLER_BUTTON_DPAD_LEFT, Action::Left},
+        {SDL_CONTROLLER_BUTTON_DPAD_RIGHT, Action::Right},
+        {SDL_CONTROLLER_BUTTON_DPAD_UP, Action::Up},
+        {SDL_CONTROLLER_BUTTON_DPAD_DOWN, Action::Down},
+        {SDL_CONTROLLER_BUTTON_A, Action::Flash},
+        {SDL_CONTROLLER_BUTTON_Y, Action::ToggleMusic},
+        {SDL_CONTROLLER_BUTTON_BACK, Action::Quit},
+    }};
+
+    static float stick(Sint16 value);
+    Pad *find_pad(SDL_JoystickID id);
+    void set(Action action);
+
+    std::bitset<SDL_NUM_SCANCODES> keys;
+    std::array<Pad, max_controllers> pads;
+    std::bitset<action_count> down;
+    std::bitset<action_count> was_down;
+    float move_x;
+    float move_y;
+};
+
+InputMap::InputMap()
+    : keys{}, pads{}, down{}, was_down{}, move_x{0.0f}, move_y{0.0f} {}
+
+void InputMap::handle(const SDL_Event &event) {
+    switch (event.type) {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+        if (event.key.keysym.scancode < SDL_NUM_SCANCODES) {
+            this->keys.set(event.key.keysym.scancode,
+                           event.type == SDL_KEYDOWN);
+        }
+        break;
+    case SDL_WINDOWEVENT:
+        // Key releases are not seen while another window has focus.
+        if (event.window.event == SDL_WINDOWEVENT_FOCUS_LOST) {
+            this->keys.reset();
+        }
+        break;
+    case SDL_CONTROLLERDEVICEADDED: {
+        SDL_GameController *controller =
+            SDL_GameControllerOpen(event.cdevice.which);
+        if (!controller) {
+            break;
+        }
+        SDL_JoystickID id =
+            SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(controller));
+        Pad *pad = this->find_pad(id);
+        if (pad || !(pad = this->find_pad(-1))) {
+            // Already open, or no free slot.
+            SDL_GameControllerClose(controller);
+            break;
+        }
+        pad->controller.reset(controller);
+        pad->id = id;
+        break;
+    }
+    case SDL_CONTROLLERDEVICEREMOVED:
+        if (Pad *pad = this->find_pad(event.cdevice.which)) {
+            *pad = Pad{};
+        }
+        break;
+    case SDL_CONTROLLERBUTTONDOWN:
+    case SDL_CONTROLLERBUTTONUP:
+        if (Pad *pad = this->find_pad(event.cbutton.which);
+            pad && event.cbutton.button < SDL_CONTROLLER_BUTTON_MAX) {
+            pad->buttons.set(event.cbutton.button,
+                             event.cbutton.state == SDL_PRESSED);
+        }
+        break;
+    case SDL_CONTROLLERAXISMOTION:
+        if (Pad *pad = this->find_pad(event.caxis.which);
+            pad && event.caxis.axis < SDL_CONTROLLER_AXIS_MAX) {
+            pad->axes[event.caxis.axis] = event.caxis.value;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// The movement axes combine the digital directions with the left sticks.
+// A stick pushed past halfway also holds the matching direction.
+void InputMap::update() {
+    this->was_down = this->down;
+    this->down.reset();
+
+    for (const auto &binding : key_bindings) {
+        if (this->keys[binding.key]) {
+            this->set(binding.action);
+        }
+    }
+
+    float stick_x = 0.0f;
+    float stick_y = 0.0f;
+    for (const auto &pad : this->pads) {
+        if (!pad.controller) {
+            continue;
+        }
+        for (const auto &binding : button_bindings) {
+            if (pad.buttons[binding.button]) {
+                this->set(binding.action);
+            }
+        }
+        stick_x += stick(pad.axes[SDL_CONTROLLER_AXIS_LEFTX]);
+        stick_y += stick(pad.axes[SDL_CONTROLLER_AXIS_LEFTY]);
+    }
+
+    float digital_x = static_cast<float>(this->held(Action::Right)) -
+                      static_cast<float>(this->held(Action::Left));
+    float digital_y = static_cast<float>(this->held(Action::Down)) -
+                      static_cast<float>(this->held(Action::Up));
+    this->move_x = std::clamp(digital_x + stick_x, -1.0f, 1.0f);
+    this->move_y = std::clamp(digital_y + stick_y, -1.0f, 1.0f);
+
+    if (stick_x <= -0.5f) {
+        this->set(Action::Left);
+    } else if (stick_x >= 0.5f) {
+        this->set(Action::Right);
+    }
+    if (stick_y <= -0.5f) {
+        this->set(Action::Up);
+    } else if (stick_y >= 0.5f) {
+        this->set(Action::Down);
+    }
+}
+
+bool InputMap::held(Action action) const {
+    return this->down[static_cast<std::size_t>(action)];
+}
+
+bool InputMap::pressed(Action action) const {
+    auto index = static_cast<std::size_t>(action);
+    return this->down[index] && !this->was_down[index];
+}
+
+std::size_t InputMap::controllers() const {
+    return static_cast<std::size_t>(std::count_if(
+        this->pads.begin(), this->pads.end(),
+        [](const Pad &pad) { return pad.controller != nullptr; }));
+}
+
+// Scales a stick axis to -1..1 with the dead zone removed.
+float InputMap::stick(Sint16 value) {
+    if (std::abs(value) < dead_zone) {
+        return 0.0f;
+    }
+    float range = 32767.0f - dead_zone;
+    float magnitude = (std::abs(static_cast<float>(value)) - dead_zone) / range;
+    return std::copysign(std::min(magnitude, 1.0f), static_cast<float>(value));
+}
+
+// Finds the open pad with the given instance id, or a free slot for -1.
+InputMap::Pad *InputMap::find_pad(SDL_JoystickID id) {
+    for (auto &pad : this->pads) {
+        if (id < 0 ? !pad.controller : pad.controller && pad.id == id) {
+            return &pad;
+        }
+    }
+    return nullptr;
+}
+
+void InputMap::set(Action action) {
+    this->down.set(static_cast<std::size_t>(action));
+}
+
+// Measures how long each key press takes to reach the screen: from the
+// SDL_KEYDOWN timestamp to the end of the first present after it was
+// handled. Keeps the most recent samples in a fixed ring.
+class InputLatency {
+  public:
+    InputLatency();
+
+    void key_down(Uint32 timestamp);
+    void presented(Uint32 now);
+    Uint32 median() const;
+    void report(int refresh_rate) const;
+
+  private:
+    static constexpr std::size_t max_pending{32};
+    static constexpr std::size_t max_samples{1024};
+    static constexpr Uint32 bucket_ms{4};
+    static constexpr std::size_t buckets{16};
+
+    std::vector<Uint32> sorted_samples() const;
+
+    std::array<Uint32, max_pending> pending;
+    std::size_t pending_count;
+    std::array<Uint32, max_samples> samples;
+    std::size_t sample_count;
+};
+
+InputLatency::InputLatency()
+    : pending{}, pending_count{0}, samples{}, sample_count{0} {}
+
+void InputLatency::key_down(Uint32 timestamp) {
+    if (this->pending_count < max_pending) {
+        this->pending[this->pending_count++] = timestamp;
+    }
+}
+
+void InputLatency::presented(Uint32 now) {
+    for (std::size_t i = 0; i < this->pending_count; i++) {
+        this->samples[this->sample_count++ % max_samples] =
+            now - this->pending[i];
+    }
+    this->pending_count = 0;
+}
+
+std::vector<Uint32> InputLatency::sorted_samples() const {
+    std::size_t n = std::min(this->sample_count, max_samples);
+    std::vector<Uint32> sorted(this->samples.begin(),
+                               this->samples.begin() + n);
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+}
+
+Uint32 InputLatency::median() const {
+    std::vector<Uint32> sorted = this->sorted_samples();
+    return sorted.empty() ? 0 : sorted[sorted.size() / 2];
+}
+
+// Prints the summary followed by a histogram in bucket_ms wide buckets, the
+// last one holding everything slower.
+void InputLatency::report(int refresh_rate) const {
+    std::vector<Uint32> sorted = this->sorted_samples();
+    std::size_t n = sorted.size();
+    if (n == 0) {
+        return;
+    }
+
+    double sum = 0.0;
+    for (Uint32 sample : sorted) {
+        sum += sample;
+    }
+
+    // Scan-out of the presented frame adds about one refresh on average.
+    double scanout_ms = 1000.0 / (refresh_rate > 0 ? refresh_rate : 60);
+    std::cout << std::format(
+        "Input to present ms: avg {:.1f} p50 {} p95 {} max {} ({} presses)\n",
+        sum / n, sorted[n / 2], sorted[n * 95 / 100], sorted.back(), n);
+    std::cout << std::format("Input to photon estimate ms: avg {:.1f}\n",
+                             sum / n + scanout_ms);
+
+    std::array<std::size_t, buckets> counts{};
+    for (Uint32 sample : sorted) {
+        counts[std::min<std::size_t>(sample / bucket_ms, buckets - 1)]++;
+    }
+    std::size_t most = *std::max_element(counts.begin(), counts.end());
+    for (std::size_t i = 0; i < buckets; i++) {
+        std::string bar(counts[i] * 40 / most, '#');
+        std::string range =
+            i + 1 < buckets
+                ? std::format("{:3}-{:<3}", i * bucket_ms,
+                              (i + 1) * bucket_ms - 1)
+                : std::format("{:3}+   ", i * bucket_ms);
+        std::cout << std::format("  {} ms {:5}{}{}\n", range, counts[i],
+                                 bar.empty() ? "" : " ", bar);
+    }
+}
+
+// Decides when each frame starts. Normal pacing sleeps a fixed delay after
+// presenting and polls as soon as it wakes. Low-latency pacing sleeps
+// until the next vsync less the measured frame work, then polls, so input
+// is read as late as possible and still makes that vsync. The work
+// estimate follows the slowest recent frame and decays slowly, with a
+// margin for present and sleep jitter.
+class FramePacer {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using Ms = std::chrono::duration<double, std::milli>;
+
+    FramePacer(bool low_latency, double period_ms, Uint32 delay_ms);
+
+    void wait_to_poll();
+    void work_done(Clock::time_point start, Clock::time_point end);
+    void presented(Clock::time_point now);
+    void wait_after_frame();
+
+    double work_ms() const { return this->work.count(); }
+
+  private:
+    static constexpr double margin_ms{1.0};
+    static constexpr double decay{0.95};
+
+    bool low_latency;
+    Ms period;
+    Uint32 delay_ms;
+    Ms work;
+    Clock::time_point deadline;
+};
+
+FramePacer::FramePacer(bool low_latency, double period_ms, Uint32 delay_ms)
+    : low_latency{low_latency}, period{period_ms}, delay_ms{delay_ms},
+      work{0.0}, deadline{} {}
+
+void FramePacer::wait_to_poll() {
+    if (!this->low_latency || this->deadline == Clock::time_point{}) {
+        return;
+    }
+    auto wake = this->deadline - this->work - Ms{margin_ms};
+    std::this_thread::sleep_until(
+        std::chrono::time_point_cast<Clock::duration>(wake));
+}
+
+// The work is measured up to the present call, so time spent blocked on
+// vsync inside it does not feed back into the estimate.
+void FramePacer::work_done(Clock::time_point start, Clock::time_point end) {
+    this->work = std::max(Ms{end - start}, this->work * decay);
+}
+
+void FramePacer::presented(Clock::time_point now) {
+    this->deadline = std::chrono::time_point_cast<Clock::duration>(
+        now + this->period);
+}
+
+void FramePacer::wait_after_frame() {
+    if (!this->low_latency) {
+        SDL_Delay(this->delay_ms);
+    }
+}
+
+// Turns the real time between frames into whole simulation ticks, carrying
+// the remainder to the next frame. Slow frames run several ticks and fast
+// ones may run none, so the simulation advances at the tick rate whatever
+// the render rate. A long stall is capped at max_steps rather than
+// replayed.
+class FixedStep {
+  public:
+    explicit FixedStep(int tick_rate);
+
+    int advance(double seconds);
+    float dt() const { return static_cast<float>(this->step); }
+
+  private:
+    static constexpr int max_steps{8};
+
+    double step;
+    double accumulator;
+};
+
+FixedStep::FixedStep(int tick_rate)
+    : step{1.0 / std::max(1, tick_rate)}, accumulator{0.0} {}
+
+int FixedStep::advance(double seconds) {
+    this->accumulator += seconds;
+    // The epsilon keeps rounding in the frame times from dropping a tick
+    // when they add up to exactly a whole number of steps.
+    int steps = static_cast<int>(this->accumulator / this->step + 1e-6);
+    this->accumulator -= steps * this->step;
+    if (steps > max_steps) {
+        steps = max_steps;
+        this->accumulator = 0.0;
+    }
+    return steps;
+}
+
+class Game {
+  public:
+    explicit Game(const Config &config);
+    ~Game();
+
+    void init();
+    void run();
+    void load_media();
+    int report() const;
+
+  private:
+    static constexpr Uint8 layer_background{0};
+    static constexpr Uint8 layer_effects{1};
+    static constexpr Uint8 layer_text{2};
+    static constexpr Uint8 layer_sprites{3};
+    static constexpr Uint8 layer_particles{4};
+    static constexpr Uint8 layer_overlay{5};
+    static constexpr Uint8 layer_hud{6};
+    static constexpr int overlay_interval{30};
+
+    TexturePtr upload(SDL_Surface *surf);
+    void draw(Uint8 layer, SDL_Texture *texture, const SDL_Rect *src,
+              const SDL_Rect *dst);
+    void render_text();
+    void update_memory_overlay();
+    void build_hud_atlas();
+    void save_state();
+    void restore_state();
+    void apply_reloads();
+    void update();
+    void keep_surface(SurfacePtr &kept, SurfacePtr surf);
+    void render_viewports();
+    void play_sound(Mix_Chunk *chunk, StereoGain gain = {1.0f, 1.0f});
+
+    const Config config;
+    const int width;
+    const int height;
+    const std::string title;
+    SDL_Event event;
+    std::uniform_int_distribution<Uint8> rand_color;
+    int font_size;
+    SDL_Color font_color;
+    std::string text_str;
+    int tile_size;
+    Camera camera;
+    TileMap tile_map;
+
+    InputMap input;
+    Simulation sim;
+    FixedStep clock;
+    Snapshot quicksave;
+
+    InputLatency input_latency;
+    std::chrono::duration<double, std::milli> render_time;
+    std::vector<float> frame_times;
+    ThreadPool thread_pool;
+    FrameArena frame_arena;
+    FrameAllocStats alloc_stats;
+
+    WindowPtr window;
+    RendererPtr renderer;
+    TexturePool texture_pool;
+    SoftRenderer soft;
+    PlasmaEffect plasma;
+    RenderQueue render_queue;
+    TexturePtr background;
+    FontManager fonts;
+    TextLayout overlay_text;
+    TexturePtr text;
+    bool show_memory;
+    int overlay_frame;
+    TexturePtr overlay;
+    SDL_Rect overlay_rect;
+    bool show_hud;
+    GlyphAtlas hud_atlas;
+    PerfHud hud;
+    SurfacePtr icon_surf;
+    TexturePtr sprite;
+    ChunkPtr cpp_sound;
+    ChunkPtr sdl_sound;
+    SoundMixer sounds;
+    AudioCallStats audio_calls;
+    MusicStream music;
+    AssetWatcher asset_watcher;
+
+    // Decoded copies of the scene images, kept only while there are extra
+    // viewports to upload them to. The cache is declared last so its
+    // textures go before the viewports' renderers.
+    SurfacePtr background_surf;
+    SurfacePtr text_surf;
+    std::vector<Viewport> viewports;
+    TextureCache viewport_textures;
+};
+
+Game::Game(const Config &config)
+    : config{config}, width{config.width}, height{config.height},
+      title{"Sound Effects and Music"}, rand_color{0, 255},
+      font_size{config.font_size}, font_color{255, 255, 255, 255},
+      text_str{"SDL"}, tile_size{std::max(1, config.tile_size)},
+      camera{0, 0, config.width, config.height}, tile_map{}, input{},
+      sim{config}, clock{config.tick_rate}, quicksave{}, input_latency{},
+      render_time{0}, frame_times{}, thread_pool{}, frame_arena{256 * 1024},
+      alloc_stats{}, window{nullptr}, renderer{nullptr}, texture_pool{}, soft{},
+      plasma{}, render_queue{}, background{nullptr},
+      fonts{static_cast<std::size_t>(config.font_budget) * 1024},
+      overlay_text{fonts, 16, config.width - 16, Align::Left}, text{nullptr},
+      show_memory{false}, overlay_frame{0}, overlay{nullptr},
+      overlay_rect{8, 8, 0, 0}, show_hud{false}, hud_atlas{}, hud{},
+      icon_surf{nullptr}, sprite{nullptr}, cpp_sound{nullptr},
+      sdl_sound{nullptr}, sounds{}, audio_calls{}, music{}, asset_watcher{},
+      background_surf{nullptr}, text_surf{nullptr}, viewports{},
+      viewport_textures{} {}
+
+Game::~Game() {
+    Mix_HaltChannel(-1);
+    this->sounds.stop();
+    this->music.stop();
+}
+
+void Game::init() {
+    this->window.reset(
+        SDL_CreateWindow(this->title.c_str(), SDL_WINDOWPOS_CENTERED,
+                         SDL_WINDOWPOS_CENTERED, this->width, this->height,
+                         this->config.headless ? SDL_WINDOW_HIDDEN : 0));
+    if (!this->window) {
+        auto error = std::format("Error creating Window: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+
+    Uint32 render_flags = this->config.renderer == RenderBackend::Accelerated
+                              ? SDL_RENDERER_ACCELERATED
+                              : SDL_RENDERER_SOFTWARE;
+    if (this->config.vsync) {
+        render_flags |= SDL_RENDERER_PRESENTVSYNC;
+    }
+    this->renderer.reset(
+        SDL_CreateRenderer(this->window.get(), -1, render_flags));
+    if (!this->renderer) {
+        auto error = std::format("Error creating Renderer: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+
+    for (int i = 0; i < this->config.viewports; i++) {
+        this->viewports.emplace_back(std::format("Viewport {}", i + 1),
+                                     this->width / 2, this->height / 2,
+                                     this->width, this->height,
+                                     this->config.headless);
+    }
+
+    require_sdl_gamecontroller();
+
+    this->thread_pool.start(this->config.thread_count());
+    this->frame_times.reserve(static_cast<std::size_t>(this->config.frames));
+    if (this->config.renderer == RenderBackend::Soft) {
+        this->soft.init(this->renderer.get(), &this->thread_pool, this->width,
+                        this->height);
+    }
+    this->plasma.init(this->renderer.get(), this->width, this->height,
+                      this->config.band_rows,
+                      this->config.renderer == RenderBackend::Soft);
+    this->render_queue.set_output(this->width, this->height);
+
+    require_sdl_image();
+    this->icon_surf.reset(resources.track(IMG_Load("images/Cpp-logo.png")));
+    if (!this->icon_surf) {
+        auto error = std::format("Error loading Surface: {}", IMG_GetError());
+        throw std::runtime_error(error);
+    }
+    SDL_SetWindowIcon(this->window.get(), this->icon_surf.get());
+
+    this->sim.rng().seed(std::random_device()());
+}
+
+void Game::load_media() {
+    SurfacePtr bg_surf{resources.track(IMG_Load("images/background.png"))};
+    if (!bg_surf) {
+        auto error = std::format("Error loading Surface: {}", IMG_GetError());
+        throw std::runtime_error(error);
+    }
+    this->background = this->upload(bg_surf.get());
+
+    int bg_w, bg_h;
+    if (SDL_QueryTexture(this->background.get(), nullptr, nullptr, &bg_w,
+                         &bg_h)) {
+        auto error = std::format("Error querying Texture: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+    this->tile_map.resize(this->config.map_tiles_x(),
+                          this->config.map_tiles_y(), this->tile_size, bg_w,
+                          bg_h);
+    this->keep_surface(this->background_surf, std::move(bg_surf));
+
+    // The font file is read once and every size is opened from it.
+    require_sdl_ttf();
+    std::ifstream font_file{"fonts/freesansbold.ttf", std::ios::binary};
+    std::vector<char> font_bytes{std::istreambuf_iterator<char>{font_file},
+                                 std::istreambuf_iterator<char>{}};
+    if (!this->fonts.load(std::move(font_bytes), this->font_size)) {
+        auto error = std::format("Error creating Font: {}", TTF_GetError());
+        throw std::runtime_error(error);
+    }
+
+    this->render_text();
+
+    this->sprite = this->upload(this->icon_surf.get());
+
+    int sprite_w, sprite_h;
+    if (SDL_QueryTexture(this->sprite.get(), nullptr, nullptr, &sprite_w,
+                         &sprite_h)) {
+        auto error = std::format("Error querying Texture: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+    this->sim.set_sprite_size(sprite_w, sprite_h);
+
+    // The window keeps its own copy of the icon and the sprite texture has
+    // the pixels, so the decoded surface is only kept for extra viewports.
+    this->keep_surface(this->icon_surf, std::move(this->icon_surf));
+
+    require_sdl_mixer(this->config.audio_buffer);
+    this->cpp_sound.reset(resources.track(Mix_LoadWAV("sounds/Cpp.ogg")));
+    if (!this->cpp_sound) {
+        auto error = std::format("Error loading Chunk: {}", Mix_GetError());
+        throw std::runtime_error(error);
+    }
+
+    this->sdl_sound.reset(resources.track(Mix_LoadWAV("sounds/SDL.ogg")));
+    if (!this->sdl_sound) {
+        auto error = std::format("Error loading Chunk: {}", Mix_GetError());
+        throw std::runtime_error(error);
+    }
+
+    if (this->config.audio_queue) {
+        this->sounds.start();
+    }
+    this->music.play("music/freesoftwaresong-8bit.ogg");
+
+    this->asset_watcher.start({"images", "fonts", "sounds", "music"});
+}
+
+// Creates a texture for the surface and, with the in-house software
+// backend, also keeps a CPU copy for it to draw from.
+TexturePtr Game::upload(SDL_Surface *surf) {
+    TexturePtr texture =
+        this->texture_pool.from_surface(this->renderer.get(), surf);
+    if (this->config.renderer == RenderBackend::Soft) {
+        this->soft.upload(texture.get(), surf);
+    }
+    return texture;
+}
+
+void Game::draw(Uint8 layer, SDL_Texture *texture, const SDL_Rect *src,
+                const SDL_Rect *dst) {
+    this->render_queue.submit(layer, texture, src, dst);
+}
+
+void Game::render_text() {
+    SurfacePtr text_surf =
+        this->fonts.render(this->font_size, this->text_str, this->font_color);
+
+    this->sim.set_text_size(text_surf->w, text_surf->h);
+
+    this->texture_pool.release(this->renderer.get(), std::move(this->text));
+    this->text = this->upload(text_surf.get());
+    this->keep_surface(this->text_surf, std::move(text_surf));
+}
+
+// Replaces a kept scene surface, dropping the textures made from the old
+// one. Without extra viewports nothing is kept.
+void Game::keep_surface(SurfacePtr &kept, SurfacePtr surf) {
+    this->viewport_textures.forget(kept.get());
+    kept = this->viewports.empty() ? nullptr : std::move(surf);
+}
+
+// Draws the background, text, sprite and particles into every extra
+// viewport, using textures made from the kept surfaces.
+void Game::render_viewports() {
+    for (auto &viewport : this->viewports) {
+        auto start = std::chrono::steady_clock::now();
+        SDL_Renderer *renderer = viewport.renderer();
+        SDL_RenderClear(renderer);
+
+        SDL_Texture *background =
+            this->viewport_textures.get(renderer, this->background_surf.get());
+        this->tile_map.for_each_visible(
+            this->camera,
+            [renderer, background](const SDL_Rect &src, const SDL_Rect &dst) {
+                SDL_RenderCopy(renderer, background, &src, &dst);
+            });
+
+        SDL_Rect text_screen = this->camera.to_screen(this->sim.text_rect());
+        SDL_Rect sprite_screen =
+            this->camera.to_screen(this->sim.sprite_rect());
+        SDL_RenderCopy(
+            renderer,
+            this->viewport_textures.get(renderer, this->text_surf.get()),
+            nullptr, &text_screen);
+        SDL_RenderCopy(
+            renderer,
+            this->viewport_textures.get(renderer, this->icon_surf.get()),
+            nullptr, &sprite_screen);
+        this->sim.particles().draw(renderer, this->camera);
+
+        SDL_RenderPresent(renderer);
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        viewport.record(elapsed.count());
+    }
+}
+
+// Redraws the memory overlay text every overlay_interval frames while it is
+// shown. The text is formatted on the frame arena; uploading the new
+// texture still goes through the pool and the resource registry.
+void Game::update_memory_overlay() {
+    if (!this->show_memory || this->overlay_frame++ % overlay_interval) {
+        return;
+    }
+
+    std::pmr::string line{&this->frame_arena};
+    auto out = std::back_inserter(line);
+    std::format_to(out, "RSS {} KiB", current_rss_kb());
+    for (std::size_t i = 0; i < resource_names.size(); i++) {
+        auto kind = static_cast<Resource>(i);
+        std::format_to(out, "  {} {}/{:.0f} KiB", resource_names[i],
+                       resources.count(kind), resources.bytes(kind) / 1024.0);
+    }
+
+    this->overlay_text.set_text(line);
+    SurfacePtr surf = this->overlay_text.render({255, 255, 0, 255});
+
+    this->overlay_rect.w = surf->w;
+    this->overlay_rect.h = surf->h;
+    this->texture_pool.release(this->renderer.get(), std::move(this->overlay));
+    this->overlay = this->upload(surf.get());
+}
+
+void Game::build_hud_atlas() {
+    SurfacePtr atlas =
+        this->hud_atlas.build(this->fonts.font(14), {255, 255, 255, 255});
+    this->hud_atlas.set_texture(this->upload(atlas.get()));
+}
+
+// Quick save of the simulation and the music position, kept in memory.
+void Game::save_state() {
+    this->quicksave.begin_write();
+    this->sim.save(this->quicksave);
+    this->quicksave.write_value(this->music.position());
+}
+
+void Game::restore_state() {
+    if (this->quicksave.empty()) {
+        return;
+    }
+    double music_pos;
+    this->quicksave.begin_read();
+    this->sim.restore(this->quicksave);
+    this->quicksave.read_value(music_pos);
+    this->music.seek(music_pos);
+}
+
+// Swaps in assets the watcher has finished decoding. Called between frames
+// so nothing is replaced while it is being drawn or played.
+void Game::apply_reloads() {
+    for (auto &asset : this->asset_watcher.take()) {
+        if (asset.path == "images/background.png") {
+            this->texture_pool.release(this->renderer.get(),
+                                       std::move(this->background));
+            this->background = this->upload(asset.surface.get());
+            this->keep_surface(this->background_surf, std::move(asset.surface));
+        } else if (asset.path == "images/Cpp-logo.png") {
+            this->texture_pool.release(this->renderer.get(),
+                                       std::move(this->sprite));
+            this->sprite = this->upload(asset.surface.get());
+            this->sim.set_sprite_size(asset.surface->w, asset.surface->h);
+            this->keep_surface(this->icon_surf, std::move(asset.surface));
+        } else if (asset.path == "fonts/freesansbold.ttf") {
+            if (!this->fonts.load(std::move(asset.bytes), this->font_size)) {
+                std::cerr << std::format("Error reloading {}: {}", asset.path,
+                                         TTF_GetError())
+                          << std::endl;
+                continue;
+            }
+            this->render_text();
+        } else if (asset.path == "sounds/Cpp.ogg") {
+            this->sounds.retire(std::move(this->cpp_sound));
+            this->cpp_sound = std::move(asset.chunk);
+        } else if (asset.path == "sounds/SDL.ogg") {
+            this->sounds.retire(std::move(this->sdl_sound));
+            this->sdl_sound = std::move(asset.chunk);
+        } else if (asset.path.starts_with("music/")) {
+            this->music.crossfade_to(asset.path, 2000);
+        }
+    }
+}
+
+// Prints the run's statistics. Headless runs fail if any steady-state frame
+// touched the heap, so a regression in the frame loop fails the run.
+int Game::report() const {
+    print_pool_stats("Texture pool", this->texture_pool.stats());
+    this->fonts.report();
+    if (this->audio_calls.calls) {
+        std::cout << std::format(
+            "Audio calls ({}): {} avg {:.1f} us max {:.1f} us, {} dropped\n",
+            this->config.audio_queue ? "command queue" : "mixer channels",
+            this->audio_calls.calls,
+            this->audio_calls.total_us / this->audio_calls.calls,
+            this->audio_calls.max_us, this->sounds.dropped());
+    }
+    for (std::size_t i = 0; i < this->viewports.size(); i++) {
+        std::cout << std::format("Viewport {}: {:.3f} ms/frame\n", i + 1,
+                                 this->viewports[i].ms_per_frame());
+    }
+    if (!this->viewports.empty()) {
+        std::cout << std::format("Viewport textures: {} uploads {} hits\n",
+                                 this->viewport_textures.uploads(),
+                                 this->viewport_textures.hits());
+    }
+    resources.report();
+    std::cout << std::format("RSS {} KiB\n", current_rss_kb());
+
+    if (this->hud.frames()) {
+        std::cout << std::format("HUD {:.3f} ms/frame over {} frames\n",
+                                 this->hud.cost_ms() / this->hud.frames(),
+                                 this->hud.frames());
+    }
+
+    const auto &queue = this->render_queue.stats();
+    if (queue.frames) {
+        std::cout << std::format(
+            "Render queue per frame: {:.1f} commands {:.1f} draw calls "
+            "{:.1f} texture changes {:.1f} blend changes {:.3f} ms sort\n",
+            static_cast<double>(queue.commands) / queue.frames,
+            static_cast<double>(queue.draw_calls) / queue.frames,
+            static_cast<double>(queue.texture_changes) / queue.frames,
+            static_cast<double>(queue.blend_changes) / queue.frames,
+            queue.sort_ms / queue.frames);
+    }
+
+    SDL_DisplayMode mode{};
+    SDL_GetWindowDisplayMode(this->window.get(), &mode);
+    this->input_latency.report(mode.refresh_rate);
+
+    std::cout << std::format("Music position {:.2f} s underruns {}\n",
+                             this->music.position(), this->music.underruns());
+
+    const auto &stats = this->alloc_stats;
+    double render_ms = stats.frames ? this->render_time.count() / stats.frames
+                                    : 0.0;
+    std::cout << std::format("Render {:.3f} ms/frame ({:.0f} fps uncapped)\n",
+                             render_ms,
+                             render_ms > 0.0 ? 1000.0 / render_ms : 0.0);
+
+    std::cout << std::format(
+        "Frames {} arena max allocs/frame {} peak bytes {} overflows {}\n",
+        stats.frames, stats.max_arena_allocations, stats.peak_arena_bytes,
+        this->frame_arena.overflows());
+    std::cout << std::format(
+        "Steady-state heap allocs total {} max/frame {}\n",
+        stats.heap_allocations, stats.max_heap_allocations);
+
+    // Single line read back by bench_sweep from headless runs.
+    if (this->config.headless && !this->frame_times.empty()) {
+        std::vector<float> sorted = this->frame_times;
+        std::sort(sorted.begin(), sorted.end());
+        std::size_t n = sorted.size();
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        std::cout << std::format(
+            "Benchmark p50 {:.3f} p95 {:.3f} p99 {:.3f} rss {} "
+            "startup {:.2f}\n",
+            sorted[n / 2], sorted[n * 95 / 100], sorted[n * 99 / 100],
+            usage.ru_maxrss, startup_timer.total_ms());
+    }
+
+    if (this->config.headless && stats.max_heap_allocations > 0) {
+        std::cerr << std::format("Steady-state frames allocated on the heap "
+                                 "(max {} per frame)\n",
+                                 stats.max_heap_allocations);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Advances the simulation one tick from the mapped actions and plays a
+// bounce sound for each wall the text hit, placed relative to the sprite.
+void Game::update() {
+    Simulation::Input moves{this->input.axis_x(), this->input.axis_y()};
+
+    this->sim.step(moves, this->font_color);
+    const SDL_Rect &player = this->sim.sprite_rect();
+    SDL_FPoint listener{player.x + player.w / 2.0f, player.y + player.h / 2.0f};
+    for (SDL_FPoint point : this->sim.bounces()) {
+        this->play_sound(this->sdl_sound.get(),
+                         spatialize(point, listener,
+                                    static_cast<float>(this->width),
+                                    static_cast<float>(this->height)));
+    }
+}
+
+// Plays through the command queue, or on SDL_mixer's own channels with
+// --audio-queue=false, timing the call either way so the two can be
+// compared. Channels take the gains as Mix_SetPanning levels.
+void Game::play_sound(Mix_Chunk *chunk, StereoGain gain) {
+    auto start = std::chrono::steady_clock::now();
+    if (this->config.audio_queue) {
+        this->sounds.play(chunk, gain);
+    } else {
+        int channel = Mix_PlayChannel(-1, chunk, 0);
+        if (channel >= 0) {
+            Mix_SetPanning(channel, static_cast<Uint8>(gain.left * 255.0f),
+                           static_cast<Uint8>(gain.right * 255.0f));
+        }
+    }
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    this->audio_calls.add(elapsed.count());
+}
+
+void Game::run() {
+    bool first_frame = true;
+    auto last_update = std::chrono::steady_clock::now();
+    Uint32 frame_delay = 1000 / std::max(1, this->config.tick_rate);
+
+    // With vsync the deadline is the display's next refresh, otherwise the
+    // next tick.
+    SDL_DisplayMode mode{};
+    SDL_GetWindowDisplayMode(this->window.get(), &mode);
+    double period_ms = this->config.vsync && mode.refresh_rate > 0
+                           ? 1000.0 / mode.refresh_rate
+                           : 1000.0 / std::max(1, this->config.tick_rate);
+    FramePacer pacer{this->config.low_latency, period_ms, frame_delay};
+
+    while (true) {
+        // Headless runs are benchmarks, so they are not paced.
+        if (!this->config.headless) {
+            pacer.wait_to_poll();
+        }
+
+        auto frame_start = std::chrono::steady_clock::now();
+        this->frame_arena.reset();
+        std::size_t heap_start = heap_allocation_count.load();
+
+        while (SDL_PollEvent(&this->event)) {
+            this->input.handle(this->event);
+            switch (event.type) {
+            case SDL_QUIT:
+                return;
+                break;
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_CLOSE) {
+                    // With several windows open SDL only sends SDL_QUIT once
+                    // all are closed, so the game window quits by itself.
+                    if (event.window.windowID ==
+                        SDL_GetWindowID(this->window.get())) {
+                        return;
+                    }
+                    std::erase_if(this->viewports, [this](const auto &view) {
+                        if (view.window_id() != this->event.window.windowID) {
+                            return false;
+                        }
+                        this->viewport_textures.forget(view.renderer());
+                        return true;
+                    });
+                }
+                break;
+            case SDL_KEYDOWN:
+                if (!event.key.repeat) {
+                    this->input_latency.key_down(event.key.timestamp);
+                }
+                switch (event.key.keysym.scancode) {
+                case SDL_SCANCODE_F1:
+                    this->show_hud = !this->show_hud;
+                    if (this->show_hud && !this->hud_atlas.ready()) {
+                        this->build_hud_atlas();
+                    }
+                    break;
+                case SDL_SCANCODE_F5:
+                    this->save_state();
+                    break;
+                case SDL_SCANCODE_F9:
+                    this->restore_state();
+                    break;
+                case SDL_SCANCODE_F3:
+                    this->show_memory = !this->show_memory;
+                    this->overlay_frame = 0;
+                    break;
+                default:
+                    break;
+                }
+            default:
+                break;
+            }
+        }
+
+        this->input.update();
+        if (this->input.pressed(Action::Quit)) {
+            return;
+        }
+        if (this->input.pressed(Action::Flash)) {
+            std::mt19937 &gen = this->sim.rng();
+            SDL_Color color{this->rand_color(gen), this->rand_color(gen),
+                            this->rand_color(gen), 255};
+            SDL_SetRenderDrawColor(this->renderer.get(), color.r, color.g,
+                                   color.b, color.a);
+            this->plasma.trigger(color);
+            this->play_sound(this->cpp_sound.get());
+        }
+        if (this->input.pressed(Action::ToggleMusic)) {
+            this->music.set_paused(!this->music.paused());
+        }
+
+        auto update_start = std::chrono::steady_clock::now();
+        this->apply_reloads();
+        // Headless runs are benchmarks of whole frames, so each frame is
+        // exactly one tick there.
+        std::chrono::duration<double> elapsed = update_start - last_update;
+        last_update = update_start;
+        int steps = this->config.headless || first_frame
+                        ? 1
+                        : this->clock.advance(elapsed.count());
+        for (int step = 0; step < steps; step++) {
+            this->update();
+        }
+
+        auto render_start = std::chrono::steady_clock::now();
+
+        SDL_RenderClear(this->renderer.get());
+
+        this->camera.follow(this->sim.sprite_rect(), this->tile_map.world_w(),
+                            this->tile_map.world_h());
+        this->tile_map.for_each_visible(
+            this->camera, [this](const SDL_Rect &src, const SDL_Rect &dst) {
+                this->draw(layer_background, this->background.get(), &src,
+                           &dst);
+            });
+
+        if (this->plasma.active()) {
+            this->plasma.update(this->thread_pool);
+            if (this->config.renderer == RenderBackend::Soft) {
+                this->soft.update(this->plasma.texture(),
+                                  this->plasma.pixels(), this->width,
+                                  this->height);
+            }
+            this->draw(layer_effects, this->plasma.texture(), nullptr,
+                       nullptr);
+        }
+
+        SDL_Rect text_screen = this->camera.to_screen(this->sim.text_rect());
+        SDL_Rect sprite_screen =
+            this->camera.to_screen(this->sim.sprite_rect());
+
+        this->draw(layer_text, this->text.get(), nullptr, &text_screen);
+        this->draw(layer_sprites, this->sprite.get(), nullptr, &sprite_screen);
+
+        ParticleSystem &particles = this->sim.particles();
+        particles.build_quads(this->camera);
+        this->render_queue.submit_shape(layer_particles, particles.quads(),
+                                        particles.quad_indices());
+
+        this->update_memory_overlay();
+        if (this->show_memory) {
+            this->draw(layer_overlay, this->overlay.get(), nullptr,
+                       &this->overlay_rect);
+        }
+        if (this->show_hud) {
+            int hud_y = this->height - PerfHud::graph_height - 16 -
+                        5 * this->hud_atlas.line_height();
+            this->hud.submit(this->render_queue, layer_hud, this->hud_atlas,
+                             this->frame_arena, 8, hud_y,
+                             this->render_queue.last_draw_calls(),
+                             resources.bytes(Resource::Texture),
+                             this->config.audio_queue ? this->sounds.playing()
+                                                      : Mix_Playing(-1));
+            this->hud.submit_graph(
+                this->render_queue, layer_hud, 8, this->height - 8,
+                1000.0f / std::max(1, this->config.tick_rate));
+        }
+
+        this->render_queue.sort();
+        if (this->config.renderer == RenderBackend::Soft) {
+            SDL_Color clear_color;
+            SDL_GetRenderDrawColor(this->renderer.get(), &clear_color.r,
+                                   &clear_color.g, &clear_color.b,
+                                   &clear_color.a);
+            this->soft.clear(clear_color);
+            this->render_queue.flush(this->soft);
+            this->soft.present(this->renderer.get());
+        } else {
+            this->render_queue.flush(this->renderer.get());
+        }
+        pacer.work_done(frame_start, std::chrono::steady_clock::now());
+        SDL_RenderPresent(this->renderer.get());
+        if (this->config.low_latency) {
+            // Reading a pixel back waits for the GPU to finish the frame, so
+            // the driver cannot queue frames ahead of the display.
+            Uint32 pixel;
+            SDL_Rect corner{0, 0, 1, 1};
+            SDL_RenderReadPixels(this->renderer.get(), &corner,
+                                 SDL_PIXELFORMAT_ARGB8888, &pixel,
+                                 sizeof(pixel));
+        }
+        this->input_latency.presented(SDL_GetTicks());
+        auto render_end = std::chrono::steady_clock::now();
+        pacer.presented(render_end);
+        this->render_time += render_end - render_start;
+        this->render_viewports();
+
+        if (first_frame) {
+            startup_timer.mark("first_frame");
+            startup_timer.report();
+            first_frame = false;
+        }
+
+        this->alloc_stats.record(this->frame_arena,
+                                 heap_allocation_count.load() - heap_start);
+
+        std::chrono::duration<float, std::milli> frame_time =
+            std::chrono::steady_clock::now() - frame_start;
+        std::chrono::duration<float, std::milli> update_time =
+            render_start - update_start;
+        std::chrono::duration<float, std::milli> draw_time =
+            render_end - render_start;
+        this->hud.record(frame_time.count(), update_time.count(),
+                         draw_time.count());
+
+        if (this->config.frames > 0) {
+            this->frame_times.push_back(frame_time.count());
+            if (this->frame_times.size() >=
+                static_cast<std::size_t>(this->config.frames)) {
+                return;
+            }
+        }
+
+        if (!this->config.headless) {
+            pacer.wait_after_frame();
+        }
+    }
+}
+
+// Only video is started up front. Audio, SDL_image, SDL_ttf, SDL_mixer and
+// SDL_sound are brought up by the require_* functions the first time they
+// are needed.
+void initialize_sdl() {
+    if (SDL_Init(SDL_INIT_VIDEO)) {
+        auto error = std::format("Error initialize SDL2: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+}
+
+// IMG_Init(0) only reports which loaders are already up.
+void require_sdl_image() {
+    int img_flags = IMG_INIT_PNG;
+    if ((IMG_Init(0) & img_flags) == img_flags) {
+        return;
+    }
+
+    if ((IMG_Init(img_flags) & img_flags) != img_flags) {
+        auto error =
+            std::format("Error initialize SDL_image: {}", IMG_GetError());
+        throw std::runtime_error(error);
+    }
+}
+
+void require_sdl_ttf() {
+    if (TTF_WasInit()) {
+        return;
+    }
+
+    if (TTF_Init()) {
+        auto error =
+            std::format("Error initialize SDL_ttf: {}", TTF_GetError());
+        throw std::runtime_error(error);
+    }
+}
+
+void require_sdl_mixer(int chunk_size) {
+    if (SDL_WasInit(SDL_INIT_AUDIO)) {
+        return;
+    }
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO)) {
+        auto error = std::format("Error initialize Audio: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+
+    int mix_flags = MIX_INIT_OGG;
+    if ((Mix_Init(mix_flags) & mix_flags) != mix_flags) {
+        auto error =
+            std::format("Error initialize SDL_mixer: {}", Mix_GetError());
+        throw std::runtime_error(error);
+    }
+
+    if (Mix_OpenAudio(MIX_DEFAULT_FREQUENCY, MIX_DEFAULT_FORMAT,
+                      MIX_DEFAULT_CHANNELS, chunk_size)) {
+        auto error = std::format("Error Opening Audio: {}", Mix_GetError());
+        throw std::runtime_error(error);
+    }
+}
+
+// SDL_sound has no init query, but its decoder list only exists while it
+// is initialized.
+void require_sdl_sound() {
+    if (Sound_AvailableDecoders()) {
+        return;
+    }
+
+    if (!Sound_Init()) {
+        auto error =
+            std::format("Error initialize SDL_sound: {}", Sound_GetError());
+        throw std::runtime_error(error);
+    }
+}
+
+// Controllers that are already connected are reported as added devices
+// once the subsystem is up, so InputMap opens them from the event stream.
+void require_sdl_gamecontroller() {
+    if (SDL_WasInit(SDL_INIT_GAMECONTROLLER)) {
+        return;
+    }
+
+    if (SDL_InitSubSystem(SDL_INIT_GAMECONTROLLER)) {
+        auto error =
+            std::format("Error initialize Game Controller: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+}
+
+// Only shuts down what the require_* functions brought up.
+void close_sdl() {
+    if (SDL_WasInit(SDL_INIT_AUDIO)) {
+        Mix_CloseAudio();
+        Mix_Quit();
+    }
+    if (TTF_WasInit()) {
+        TTF_Quit();
+    }
+    if (IMG_Init(0)) {
+        IMG_Quit();
+    }
+    if (Sound_AvailableDecoders()) {
+        Sound_Quit();
+    }
+    SDL_Quit();
+}
+
+// Checks each SIMD pixel kernel against its scalar reference on the same
+// input and prints the throughput of both.
+int bench_kernels() {
+    using Kernel = void (*)(Uint32 *, const Uint32 *, int);
+    constexpr int count = (1 << 20) + 3;
+    constexpr int iterations = 50;
 
-    void init();
-    void run();
-    void load_media();
+    std::mt19937 gen{12345};
+    std::vector<Uint32> src(count), base(count), premul(count);
+    std::vector<Uint32> expect(count), got(count);
+    for (int i = 0; i < count; i++) {
+        src[i] = gen();
+        base[i] = gen();
+    }
+    premultiply_scalar(premul.data(), src.data(), count);
 
-    static constexpr int width{800};
-    static constexpr int height{600};
+    struct Case {
+        const char *name;
+        Kernel scalar;
+        Kernel simd;
+        const Uint32 *input;
+    };
+    const Case cases[] = {
+        {"swizzle_rb", swizzle_rb_scalar, swizzle_rb, src.data()},
+        {"premultiply", premultiply_scalar, premultiply, src.data()},
+        {"blend_premultiplied", blend_premultiplied_scalar,
+         blend_premultiplied, premul.data()},
+    };
 
-  private:
-    void update_text();
-    void update_sprite();
+    auto throughput = [&](Kernel kernel, const Uint32 *input) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            kernel(got.data(), input, count);
+        }
+        std::chrono::duration<double> secs =
+            std::chrono::steady_clock::now() - start;
+        return count * sizeof(Uint32) * iterations / secs.count() / 1e6;
+    };
 
-    const std::string title;
-    SDL_Event event;
-    std::mt19937 gen;
-    std::uniform_int_distribution<Uint8> rand_color;
-    int font_size;
-    SDL_Color font_color;
-    std::string text_str;
-    SDL_Rect text_rect;
-    const int text_vel;
-    int text_xvel;
-    int text_yvel;
-    SDL_Rect sprite_rect;
-    const int sprite_vel;
-
-    const Uint8 *keystate;
-
-    std::unique_ptr<SDL_Window, decltype(&SDL_DestroyWindow)> window;
-    std::unique_ptr<SDL_Renderer, decltype(&SDL_DestroyRenderer)> renderer;
-    std::unique_ptr<SDL_Texture, decltype(&SDL_DestroyTexture)> background;
-    std::unique_ptr<TTF_Font, decltype(&TTF_CloseFont)> font;
-    std::unique_ptr<SDL_Surface, decltype(&SDL_FreeSurface)> text_surf;
-    std::unique_ptr<SDL_Texture, decltype(&SDL_DestroyTexture)> text;
-    std::unique_ptr<SDL_Surface, decltype(&SDL_FreeSurface)> icon_surf;
-    std::unique_ptr<SDL_Texture, decltype(&SDL_DestroyTexture)> sprite;
-    std::unique_ptr<Mix_Chunk, decltype(&Mix_FreeChunk)> cpp_sound;
-    std::unique_ptr<Mix_Chunk, decltype(&Mix_FreeChunk)> sdl_sound;
-    std::unique_ptr<Mix_Music, decltype(&Mix_FreeMusic)> music;
-};
-
-Game::Game()
-    : title{"Sound Effects and Music"}, gen{}, rand_color{0, 255},
-      font_size{80}, font_color{255, 255, 255, 255}, text_str{"SDL"},
-      text_rect{0, 0, 0, 0}, text_vel{3}, text_xvel{3}, text_yvel{3},
-      sprite_rect{0, 0, 0, 0}, sprite_vel{5},
-      keystate{SDL_GetKeyboardState(nullptr)},
-      window{nullptr, SDL_DestroyWindow},
-      renderer{nullptr, SDL_DestroyRenderer},
-      background{nullptr, SDL_DestroyTexture}, font{nullptr, TTF_CloseFont},
-      text_surf{nullptr, SDL_FreeSurface}, text{nullptr, SDL_DestroyTexture},
-      icon_surf{nullptr, SDL_FreeSurface}, sprite{nullptr, SDL_DestroyTexture},
-      cpp_sound{nullptr, Mix_FreeChunk}, sdl_sound{nullptr, Mix_FreeChunk},
-      music{nullptr, Mix_FreeMusic} {}
+    bool all_exact = true;
+    for (const auto &c : cases) {
+        expect = base;
+        got = base;
+        c.scalar(expect.data(), c.input, count);
+        c.simd(got.data(), c.input, count);
+        bool exact = expect == got;
+        all_exact = all_exact && exact;
 
-Game::~Game() {
-    Mix_HaltChannel(-1);
-    Mix_HaltMusic();
+        double scalar_mbs = throughput(c.scalar, c.input);
+        double simd_mbs = throughput(c.simd, c.input);
+        std::cout << std::format("{:<20} scalar {:8.0f} MB/s simd {:8.0f} MB/s"
+                                 " {}\n",
+                                 c.name, scalar_mbs, simd_mbs,
+                                 exact ? "bit-exact" : "MISMATCH");
+    }
+
+    return all_exact ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-void Game::init() {
-    this->window.reset(
-        SDL_CreateWindow(this->title.c_str(), SDL_WINDOWPOS_CENTERED,
-                         SDL_WINDOWPOS_CENTERED, this->width, this->height, 0));
-    if (!this->window) {
+// Ticks 200k live particles at 60 Hz without rendering, first on one core
+// and then across the thread pool, topping the pool back up every tick.
+int bench_particles(const Config &config) {
+    constexpr std::size_t live = 200000;
+    constexpr int ticks = 600;
+    constexpr float dt = 1.0f / 60.0f;
+
+    std::mt19937 gen{12345};
+    ThreadPool pool;
+    pool.start(config.thread_count());
+
+    auto run = [&](bool threaded) {
+        ParticleSystem particles{
+            live, static_cast<std::size_t>(config.particle_chunk)};
+        std::size_t before = heap_allocation_count.load();
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t < ticks; t++) {
+            int missing = static_cast<int>(live - particles.size());
+            particles.burst(400.0f, 300.0f, missing, {255, 255, 255, 255},
+                            gen);
+            if (threaded) {
+                particles.update(dt, pool);
+            } else {
+                particles.update(dt);
+            }
+        }
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        double tick_ms = elapsed.count() / ticks;
+        std::cout << std::format(
+            "Particles {} {:>8}: {:.3f} ms/tick ({:.0f} ticks/s), "
+            "heap allocs {}\n",
+            live, threaded ? std::format("{} thr", pool.size()) : "1 thr",
+            tick_ms, 1000.0 / tick_ms,
+            heap_allocation_count.load() - before);
+        return tick_ms;
+    };
+
+    double single_ms = run(false);
+    run(true);
+
+    return single_ms <= 1000.0 / 60.0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Regenerates the full-screen plasma as fast as possible for a few seconds
+// and prints how many streaming texture updates per second that reached.
+void bench_streaming(const Config &config) {
+    WindowPtr window{SDL_CreateWindow("Streaming benchmark",
+                                      SDL_WINDOWPOS_CENTERED,
+                                      SDL_WINDOWPOS_CENTERED, config.width,
+                                      config.height, SDL_WINDOW_HIDDEN)};
+    if (!window) {
         auto error = std::format("Error creating Window: {}", SDL_GetError());
         throw std::runtime_error(error);
     }
 
-    this->renderer.reset(
-        SDL_CreateRenderer(this->window.get(), -1, SDL_RENDERER_ACCELERATED));
-    if (!this->renderer) {
+    RendererPtr renderer{
+        SDL_CreateRenderer(window.get(), -1, SDL_RENDERER_ACCELERATED)};
+    if (!renderer) {
         auto error = std::format("Error creating Renderer: {}", SDL_GetError());
         throw std::runtime_error(error);
     }
 
-    this->icon_surf.reset(IMG_Load("images/Cpp-logo.png"));
-    if (!this->icon_surf) {
-        auto error = std::format("Error loading Surface: {}", IMG_GetError());
-        throw std::runtime_error(error);
+    ThreadPool pool;
+    pool.start(config.thread_count());
+    PlasmaEffect plasma;
+    plasma.init(renderer.get(), config.width, config.height,
+                config.band_rows);
+
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed{0};
+    while (elapsed.count() < 3.0) {
+        if (!plasma.active()) {
+            plasma.trigger({255, 128, 64, 255});
+        }
+        plasma.update(pool);
+        SDL_RenderClear(renderer.get());
+        SDL_RenderCopy(renderer.get(), plasma.texture(), nullptr, nullptr);
+        SDL_RenderPresent(renderer.get());
+        elapsed = std::chrono::steady_clock::now() - start;
     }
-    SDL_SetWindowIcon(this->window.get(), this->icon_surf.get());
 
-    this->gen.seed(std::random_device()());
+    std::cout << std::format(
+        "Streaming {}x{} on {} threads: {:.1f} updates/s\n", config.width,
+        config.height, pool.size(), plasma.updates() / elapsed.count());
 }
 
-void Game::load_media() {
-    this->background.reset(
-        IMG_LoadTexture(this->renderer.get(), "images/background.png"));
-    if (!this->background) {
-        auto error = std::format("Error loading Texture: {}", IMG_GetError());
+// Pushes 50k copies of 32 textures on 4 layers through the render queue
+// each frame and compares its texture changes with drawing them in
+// submission order.
+void bench_render_queue(const Config &config) {
+    constexpr int commands = 50000;
+    constexpr int texture_count = 32;
+    constexpr int frames = 100;
+
+    WindowPtr window{SDL_CreateWindow("Render queue benchmark",
+                                      SDL_WINDOWPOS_CENTERED,
+                                      SDL_WINDOWPOS_CENTERED, config.width,
+                                      config.height, SDL_WINDOW_HIDDEN)};
+    if (!window) {
+        auto error = std::format("Error creating Window: {}", SDL_GetError());
         throw std::runtime_error(error);
     }
 
-    this->font.reset(TTF_OpenFont("fonts/freesansbold.ttf", this->font_size));
-    if (!this->font) {
-        auto error = std::format("Error creating Font: {}", TTF_GetError());
+    RendererPtr renderer{
+        SDL_CreateRenderer(window.get(), -1, SDL_RENDERER_ACCELERATED)};
+    if (!renderer) {
+        auto error = std::format("Error creating Renderer: {}", SDL_GetError());
         throw std::runtime_error(error);
     }
 
-    this->text_surf.reset(TTF_RenderText_Blended(
-        this->font.get(), this->text_str.c_str(), this->font_color));
-    if (!this->text_surf) {
-        auto error =
-            std::format("Error loading text Surface: {}", TTF_GetError());
-        throw std::runtime_error(error);
+    std::vector<TexturePtr> textures;
+    for (int i = 0; i < texture_count; i++) {
+        textures.emplace_back(SDL_CreateTexture(
+            renderer.get(), SDL_PIXELFORMAT_ARGB8888,
+            SDL_TEXTUREACCESS_STATIC, 16, 16));
+        SDL_SetTextureBlendMode(textures.back().get(),
+                                i % 2 ? SDL_BLENDMODE_BLEND
+                                      : SDL_BLENDMODE_NONE);
     }
 
-    this->text_rect.w = this->text_surf->w;
-    this->text_rect.h = this->text_surf->h;
+    std::mt19937 gen{12345};
+    std::uniform_int_distribution<int> pick_texture{0, texture_count - 1};
+    std::uniform_int_distribution<int> pick_layer{0, 3};
+    std::uniform_int_distribution<int> pick_pos{0, config.width - 16};
 
-    this->text.reset(SDL_CreateTextureFromSurface(this->renderer.get(),
-                                                  this->text_surf.get()));
-    if (!this->text) {
-        auto error = std::format("Error creating Texture from Surface: {}",
-                                 SDL_GetError());
-        throw std::runtime_error(error);
+    RenderQueue queue;
+    queue.set_output(config.width, config.height);
+    std::size_t unsorted_changes = 0;
+    std::chrono::duration<double, std::milli> flush_time{0};
+
+    for (int f = 0; f < frames; f++) {
+        SDL_Texture *last = nullptr;
+        for (int i = 0; i < commands; i++) {
+            SDL_Texture *texture = textures[pick_texture(gen)].get();
+            SDL_Rect dst{pick_pos(gen), pick_pos(gen) % config.height, 16, 16};
+            queue.submit(static_cast<Uint8>(pick_layer(gen)), texture,
+                         nullptr, &dst);
+            if (last && texture != last) {
+                unsorted_changes++;
+            }
+            last = texture;
+        }
+
+        queue.sort();
+        auto start = std::chrono::steady_clock::now();
+        queue.flush(renderer.get());
+        SDL_RenderPresent(renderer.get());
+        flush_time += std::chrono::steady_clock::now() - start;
     }
 
-    this->sprite.reset(SDL_CreateTextureFromSurface(this->renderer.get(),
-                                                    this->icon_surf.get()));
-    if (!this->sprite) {
-        auto error = std::format("Error creating Texture from Surface: {}",
-                                 SDL_GetError());
-        throw std::runtime_error(error);
+    const auto &stats = queue.stats();
+    std::cout << std::format(
+        "Render queue {} commands/frame: sort {:.3f} ms flush {:.3f} ms\n",
+        commands, stats.sort_ms / frames, flush_time.count() / frames);
+    std::cout << std::format(
+        "Texture changes/frame sorted {} unsorted {}, blend changes {}, "
+        "draw calls {}\n",
+        stats.texture_changes / frames, unsorted_changes / frames,
+        stats.blend_changes / frames, stats.draw_calls / frames);
+}
+
+// Metrics of one headless run, in the order they appear in the baseline
+// file. Lower is better for all of them.
+constexpr std::array<const char *, 5> sweep_metrics{
+    "p50_ms", "p95_ms", "p99_ms", "rss_kb", "startup_ms"};
+
+using SweepResults = std::map<std::string, std::array<double, 5>>;
+
+SweepResults read_baseline(const std::string &path) {
+    SweepResults baseline;
+    std::ifstream file{path};
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields{line};
+        std::string name;
+        std::array<double, 5> metrics;
+        if (!(fields >> name)) {
+            continue;
+        }
+        for (double &metric : metrics) {
+            fields >> metric;
+        }
+        if (fields) {
+            baseline[name] = metrics;
+        }
     }
+    return baseline;
+}
 
-    if (SDL_QueryTexture(this->sprite.get(), nullptr, nullptr,
-                         &this->sprite_rect.w, &this->sprite_rect.h)) {
-        auto error = std::format("Error querying Texture: {}", SDL_GetError());
+// Runs this executable headless over a matrix of live particle counts,
+// resolutions, renderer backends and audio buffer sizes, repeating each
+// run and keeping the median of every metric, then compares the
+// frame-time percentiles, peak RSS and startup time with the baseline
+// file. Children use SDL's dummy audio driver unless SDL_AUDIODRIVER is
+// already set, so the sweep runs without a sound device. Fails when a
+// metric is worse than its baseline by more than the threshold
+// percentage. The baseline is written instead when it does not exist yet
+// or --update-baseline is given.
+int bench_sweep(const Config &config) {
+    constexpr std::array<int, 3> particle_counts{1000, 10000, 100000};
+    constexpr std::array<std::pair<int, int>, 2> resolutions{
+        {{800, 600}, {1280, 720}}};
+    constexpr std::array<const char *, 3> renderers{"accelerated",
+                                                    "sdl-software", "soft"};
+    constexpr std::array<int, 2> audio_buffers{512, 2048};
+    constexpr int repeats = 3;
+    int frames = config.frames > 0 ? config.frames : 300;
+
+    setenv("SDL_AUDIODRIVER", "dummy", 0);
+
+    // The path is resolved here, since /proc/self/exe names whichever
+    // process reads it. Children are spawned straight from an argv array,
+    // so no shell sees the arguments and nothing needs quoting.
+    std::array<char, 4096> exe_path;
+    ssize_t exe_len =
+        readlink("/proc/self/exe", exe_path.data(), exe_path.size() - 1);
+    if (exe_len <= 0) {
+        auto error = std::format("Error resolving /proc/self/exe: {}",
+                                 std::strerror(errno));
         throw std::runtime_error(error);
     }
+    std::string exe{exe_path.data(), static_cast<std::size_t>(exe_len)};
 
-    this->cpp_sound.reset(Mix_LoadWAV("sounds/Cpp.ogg"));
-    if (!this->cpp_sound) {
-        auto error = std::format("Error loading Chunk: {}", Mix_GetError());
-        throw std::runtime_error(error);
+    auto run_child = [&exe](const std::string &name,
+                            const std::vector<std::string> &args) {
+        std::vector<char *> argv{exe.data()};
+        for (const auto &arg : args) {
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        int fds[2];
+        if (pipe(fds)) {
+            auto error = std::format("Error creating pipe: {}",
+                                     std::strerror(errno));
+            throw std::runtime_error(error);
+        }
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, fds[0]);
+        posix_spawn_file_actions_addclose(&actions, fds[1]);
+        pid_t pid;
+        int spawned = posix_spawn(&pid, exe.c_str(), &actions, nullptr,
+                                  argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(fds[1]);
+        if (spawned) {
+            close(fds[0]);
+            auto error = std::format("Error running {}: {}", name,
+                                     std::strerror(spawned));
+            throw std::runtime_error(error);
+        }
+
+        std::array<double, 5> metrics{};
+        bool found = false;
+        {
+            Handle<FILE, std::fclose> output{fdopen(fds[0], "r")};
+            std::array<char, 512> line;
+            while (output &&
+                   std::fgets(line.data(), line.size(), output.get())) {
+                found |= std::sscanf(line.data(),
+                                     "Benchmark p50 %lf p95 %lf p99 %lf "
+                                     "rss %lf startup %lf",
+                                     &metrics[0], &metrics[1], &metrics[2],
+                                     &metrics[3], &metrics[4]) == 5;
+            }
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!found) {
+            auto error = std::format("No result from {} (exit status {})",
+                                     name, status);
+            throw std::runtime_error(error);
+        }
+        return metrics;
+    };
+
+    SweepResults results;
+    for (int particles : particle_counts) {
+        for (auto [w, h] : resolutions) {
+            for (const char *renderer : renderers) {
+                for (int audio_buffer : audio_buffers) {
+                    std::string name =
+                        std::format("particles{}_{}x{}_{}_audio{}", particles,
+                                    w, h, renderer, audio_buffer);
+                    std::vector<std::string> args{
+                        "--config=" + config.config_path,
+                        "--headless",
+                        std::format("--frames={}", frames),
+                        "--vsync=false",
+                        "--low-latency=false",
+                        std::format("--width={}", w),
+                        std::format("--height={}", h),
+                        std::format("--renderer={}", renderer),
+                        std::format("--audio-buffer={}", audio_buffer),
+                        std::format("--live-particles={}", particles),
+                        std::format("--particle-capacity={}", particles),
+                        std::format("--threads={}", config.threads)};
+
+                    std::array<std::array<double, repeats>, 5> runs{};
+                    for (int repeat = 0; repeat < repeats; repeat++) {
+                        std::array<double, 5> run = run_child(name, args);
+                        for (std::size_t i = 0; i < run.size(); i++) {
+                            runs[i][repeat] = run[i];
+                        }
+                    }
+                    std::array<double, 5> metrics{};
+                    for (std::size_t i = 0; i < metrics.size(); i++) {
+                        std::sort(runs[i].begin(), runs[i].end());
+                        metrics[i] = runs[i][repeats / 2];
+                    }
+
+                    results[name] = metrics;
+                    std::cout << std::format(
+                        "{:<48} p50 {:6.2f} p95 {:6.2f} p99 {:6.2f} ms "
+                        "rss {:7.0f} kB startup {:7.1f} ms\n",
+                        name, metrics[0], metrics[1], metrics[2], metrics[3],
+                        metrics[4]);
+                }
+            }
+        }
     }
 
-    this->sdl_sound.reset(Mix_LoadWAV("sounds/SDL.ogg"));
-    if (!this->sdl_sound) {
-        auto error = std::format("Error loading Chunk: {}", Mix_GetError());
-        throw std::runtime_error(error);
+    SweepResults baseline = read_baseline(config.baseline);
+    if (baseline.empty() || config.update_baseline) {
+        std::ofstream file{config.baseline};
+        for (const auto &[name, metrics] : results) {
+            file << name;
+            for (double metric : metrics) {
+                file << ' ' << metric;
+            }
+            file << '\n';
+        }
+        std::cout << std::format("Wrote baseline {}\n", config.baseline);
+        return EXIT_SUCCESS;
     }
 
-    this->music.reset(Mix_LoadMUS("music/freesoftwaresong-8bit.ogg"));
-    if (!this->music) {
-        auto error = std::format("Error loading Music: {}", Mix_GetError());
-        throw std::runtime_error(error);
+    int regressions = 0;
+    double limit = 1.0 + config.threshold / 100.0;
+    for (const auto &[name, metrics] : results) {
+        auto it = baseline.find(name);
+        if (it == baseline.end()) {
+            std::cout << std::format("{} has no baseline\n", name);
+            continue;
+        }
+        for (std::size_t i = 0; i < metrics.size(); i++) {
+            double before = it->second[i];
+            if (before > 0.0 && metrics[i] > before * limit) {
+                std::cout << std::format(
+                    "REGRESSION {} {}: {:.3f} -> {:.3f} ({:+.1f}%)\n", name,
+                    sweep_metrics[i], before, metrics[i],
+                    (metrics[i] / before - 1.0) * 100.0);
+                regressions++;
+            }
+        }
     }
+
+    std::cout << std::format("{} regressions past {}%\n", regressions,
+                             config.threshold);
+    return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
-void Game::update_text() {
-    this->text_rect.x += this->text_xvel;
-    this->text_rect.y += this->text_yvel;
+// Saves and restores a simulation holding 100k live particles, and encodes
+// the delta between snapshots one tick apart. Fails if saving or restoring
+// takes a millisecond or more.
+int bench_snapshot(const Config &config) {
+    constexpr int live = 100000;
+    constexpr int iterations = 200;
+    using Ms = std::chrono::duration<double, std::milli>;
 
-    if (this->text_rect.x < 0) {
-        this->text_xvel = this->text_vel;
-        Mix_PlayChannel(-1, this->sdl_sound.get(), 0);
-    } else if (this->text_rect.x + this->text_rect.w > this->width) {
-        this->text_xvel = -this->text_vel;
-        Mix_PlayChannel(-1, this->sdl_sound.get(), 0);
+    Config sim_config = config;
+    sim_config.particle_capacity = live;
+    Simulation sim{sim_config};
+    sim.rng().seed(12345);
+    sim.set_text_size(100, 50);
+    sim.particles().burst(400.0f, 300.0f, live, {255, 255, 255, 255},
+                          sim.rng());
+
+    Snapshot snapshot;
+    snapshot.begin_write();
+    sim.save(snapshot);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        snapshot.begin_write();
+        sim.save(snapshot);
     }
-    if (this->text_rect.y < 0) {
-        this->text_yvel = this->text_vel;
-        Mix_PlayChannel(-1, this->sdl_sound.get(), 0);
-    } else if (this->text_rect.y + this->text_rect.h > this->height) {
-        this->text_yvel = -this->text_vel;
-        Mix_PlayChannel(-1, this->sdl_sound.get(), 0);
+    Ms save_time = (std::chrono::steady_clock::now() - start) / iterations;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        snapshot.begin_read();
+        sim.restore(snapshot);
     }
+    Ms restore_time = (std::chrono::steady_clock::now() - start) / iterations;
+
+    std::vector<std::byte> prev = snapshot.bytes();
+    sim.step({}, {255, 255, 255, 255});
+    snapshot.begin_write();
+    sim.save(snapshot);
+
+    std::vector<std::byte> delta, decoded;
+    start = std::chrono::steady_clock::now();
+    encode_delta(prev, snapshot.bytes(), delta);
+    Ms encode_time = std::chrono::steady_clock::now() - start;
+    decode_delta(prev, delta, decoded);
+    bool exact = decoded == snapshot.bytes();
+
+    std::cout << std::format(
+        "Snapshot {} particles {:.1f} KiB save {:.3f} ms restore {:.3f} ms\n",
+        sim.particles().size(), snapshot.bytes().size() / 1024.0,
+        save_time.count(), restore_time.count());
+    std::cout << std::format(
+        "Delta after one tick {:.1f} KiB encode {:.3f} ms {}\n",
+        delta.size() / 1024.0, encode_time.count(),
+        exact ? "round-trips" : "MISMATCH");
+
+    return exact && save_time.count() < 1.0 && restore_time.count() < 1.0
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE;
 }
 
-void Game::update_sprite() {
-    if (this->keystate[SDL_SCANCODE_LEFT] || this->keystate[SDL_SCANCODE_A]) {
-        this->sprite_rect.x -= this->sprite_vel;
-    }
-    if (this->keystate[SDL_SCANCODE_RIGHT] || this->keystate[SDL_SCANCODE_D]) {
-        this->sprite_rect.x += this->sprite_vel;
+// Pushes a body right for a second at several render rates, each frame
+// advanced through FixedStep, and checks that it ends up in the same place
+// whatever the frame rate. Then does the same at several tick rates and
+// checks the distance against the exact solution, and that the body
+// settles at sprite_speed. Also checks that diagonal input is no faster
+// than straight input and that a body held against a wall stays inside the
+// bounds.
+int bench_motion(const Config &config) {
+    constexpr float size = 32.0f;
+    constexpr std::array<int, 5> render_rates{17, 30, 60, 144, 240};
+    constexpr std::array<int, 5> tick_rates{20, 30, 60, 120, 240};
+    float accel =
+        static_cast<float>(config.sprite_speed * config.sprite_damping);
+    float damping = static_cast<float>(config.sprite_damping);
+
+    auto run = [&](int render_rate, float seconds, float dir_x, float dir_y,
+                   int tick_rate) {
+        MotionSystem motion{accel, damping};
+        motion.set_bounds(static_cast<float>(config.width),
+                          static_cast<float>(config.height));
+        std::size_t body = motion.add(size, size);
+        motion.steer(body, dir_x, dir_y);
+        FixedStep clock{tick_rate};
+        int frames = static_cast<int>(seconds * render_rate);
+        for (int frame = 0; frame < frames; frame++) {
+            int steps = clock.advance(1.0 / render_rate);
+            for (int step = 0; step < steps; step++) {
+                motion.update(clock.dt());
+            }
+        }
+        return motion;
+    };
+
+    bool steady = true;
+    int expected_x =
+        run(render_rates[0], 1.0f, 1.0f, 0.0f, config.tick_rate).rect(0).x;
+    for (int render_rate : render_rates) {
+        MotionSystem motion =
+            run(render_rate, 1.0f, 1.0f, 0.0f, config.tick_rate);
+        int x = motion.rect(0).x;
+        steady = steady && x == expected_x;
+        std::cout << std::format("Render {:3} Hz: x {:4} speed {:6.1f} {}\n",
+                                 render_rate, x, motion.speed(0),
+                                 x == expected_x ? "ok" : "DRIFT");
     }
-    if (this->keystate[SDL_SCANCODE_UP] || this->keystate[SDL_SCANCODE_W]) {
-        this->sprite_rect.y -= this->sprite_vel;
+
+    // From rest, x(t) = s t - s (1 - exp(-k t)) / k with top speed s.
+    double top = config.sprite_speed;
+    double k = config.sprite_damping;
+    double exact = k > 0.0 ? top * (1.0 - (1.0 - std::exp(-k)) / k) : 0.0;
+    bool same_distance = true;
+    for (int tick_rate : tick_rates) {
+        MotionSystem motion = run(60, 1.0f, 1.0f, 0.0f, tick_rate);
+        int x = motion.rect(0).x;
+        bool ok = std::abs(x - exact) <= 1.0 &&
+                  std::abs(motion.speed(0) - top) <= 0.01 * top;
+        same_distance = same_distance && ok;
+        std::cout << std::format("Tick {:3} Hz: x {:4} (exact {:6.1f}) speed "
+                                 "{:6.1f} {}\n",
+                                 tick_rate, x, exact, motion.speed(0),
+                                 ok ? "ok" : "DRIFT");
     }
-    if (this->keystate[SDL_SCANCODE_DOWN] || this->keystate[SDL_SCANCODE_S]) {
-        this->sprite_rect.y += this->sprite_vel;
+
+    MotionSystem straight = run(60, 0.25f, 1.0f, 0.0f, config.tick_rate);
+    MotionSystem diagonal = run(60, 0.25f, 1.0f, 1.0f, config.tick_rate);
+    bool same_speed = std::abs(straight.speed(0) - diagonal.speed(0)) < 0.01f;
+    std::cout << std::format("Diagonal speed {:.1f} straight {:.1f} {}\n",
+                             diagonal.speed(0), straight.speed(0),
+                             same_speed ? "ok" : "FASTER");
+
+    SDL_Rect corner = run(60, 10.0f, 1.0f, 1.0f, config.tick_rate).rect(0);
+    bool clamped = corner.x + corner.w == config.width &&
+                   corner.y + corner.h == config.height;
+    std::cout << std::format("Held into corner at {},{} {}\n", corner.x,
+                             corner.y, clamped ? "ok" : "ESCAPED");
+
+    return steady && same_distance && same_speed && clamped ? EXIT_SUCCESS
+                                                            : EXIT_FAILURE;
+}
+
+// Pans a window-sized camera corner to corner across square maps from 100
+// to 10k tiles a side, with one tile set per chunk along the diagonal, and
+// times culling the visible tiles each frame. Fails unless every map visits
+// the same number of tiles and the largest costs at most twice the
+// smallest per frame, so the frame cost does not grow with the map.
+int bench_map(const Config &config) {
+    constexpr std::array<int, 3> sizes{100, 1000, 10000};
+    constexpr int frames = 2000;
+    constexpr int repeats = 3;
+    using Clock = std::chrono::steady_clock;
+    using Us = std::chrono::duration<double, std::micro>;
+
+    int tile_size = std::max(1, config.tile_size);
+    std::vector<double> costs;
+    std::vector<std::size_t> visits;
+    for (int size : sizes) {
+        TileMap map;
+        map.resize(size, size, tile_size, config.width, config.height);
+        for (int i = 0; i < size; i += TileMap::chunk_size) {
+            map.set_tile(i, i, 0);
+        }
+
+        Camera camera{0, 0, config.width, config.height};
+        int span_x = std::max(0, map.world_w() - camera.w);
+        int span_y = std::max(0, map.world_h() - camera.h);
+        std::size_t visited = 0;
+        Uint32 checksum = 0;
+        double best_us = 0.0;
+        for (int repeat = 0; repeat < repeats; repeat++) {
+            visited = 0;
+            auto start = Clock::now();
+            for (int frame = 0; frame < frames; frame++) {
+                auto t = static_cast<double>(frame) / (frames - 1);
+                SDL_Rect target{static_cast<int>(span_x * t) + camera.w / 2,
+                                static_cast<int>(span_y * t) + camera.h / 2,
+                                0, 0};
+                camera.follow(target, map.world_w(), map.world_h());
+                map.for_each_visible(
+                    camera, [&](const SDL_Rect &src, const SDL_Rect &dst) {
+                        checksum += src.x ^ dst.y;
+                        visited++;
+                    });
+            }
+            double us = Us{Clock::now() - start}.count() / frames;
+            best_us = repeat ? std::min(best_us, us) : us;
+        }
+
+        costs.push_back(best_us);
+        visits.push_back(visited / frames);
+        std::cout << std::format(
+            "Map {:5}x{:<5} {:6.2f} us/frame {:4} tiles/frame ({:08x})\n",
+            size, size, best_us, visited / frames, checksum);
     }
+
+    bool same_tiles =
+        std::all_of(visits.begin(), visits.end(),
+                    [&](std::size_t v) { return v == visits.front(); });
+    bool flat = costs.back() <= 2.0 * costs.front();
+    std::cout << std::format("Largest map costs {:.2f}x the smallest {}\n",
+                             costs.back() / costs.front(),
+                             same_tiles && flat ? "ok" : "GROWS");
+    return same_tiles && flat ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-void Game::run() {
-    if (Mix_PlayMusic(this->music.get(), -1)) {
-        auto error = std::format("Error playing Music: {}", Mix_GetError());
+// Scrolls a log that grows by 50 wrapped lines a frame to 10k lines, then
+// scrolls back up through it, drawing the visible lines into a window-sized
+// surface each frame. Fails if the 99th percentile frame misses 60 FPS.
+// Then rewraps the whole log at half the width and back to show the
+// line-break cache.
+int bench_text(const Config &config) {
+    constexpr int total_lines = 10000;
+    constexpr int lines_per_frame = 50;
+    constexpr int scroll_frames = 200;
+    constexpr std::array<std::string_view, 8> words{
+        "bounce", "particle", "texture", "render", "queue", "sprite",
+        "channel", "viewport"};
+    using Ms = std::chrono::duration<double, std::milli>;
+
+    require_sdl_ttf();
+    std::ifstream font_file{"fonts/freesansbold.ttf", std::ios::binary};
+    FontManager fonts{static_cast<std::size_t>(config.font_budget) * 1024};
+    if (!fonts.load({std::istreambuf_iterator<char>{font_file},
+                     std::istreambuf_iterator<char>{}},
+                    16)) {
+        auto error = std::format("Error creating Font: {}", TTF_GetError());
         throw std::runtime_error(error);
     }
 
-    while (true) {
-        while (SDL_PollEvent(&this->event)) {
-            switch (event.type) {
-            case SDL_QUIT:
-                return;
-                break;
-            case SDL_KEYDOWN:
-                switch (event.key.keysym.scancode) {
-                case SDL_SCANCODE_ESCAPE:
-                    return;
-                    break;
-                case SDL_SCANCODE_SPACE:
-                    SDL_SetRenderDrawColor(this->renderer.get(),
-                                           this->rand_color(this->gen),
-                                           this->rand_color(this->gen),
-                                           this->rand_color(this->gen), 255);
-                    Mix_PlayChannel(-1, this->cpp_sound.get(), 0);
-                    break;
-                case SDL_SCANCODE_M:
-                    if (Mix_PausedMusic()) {
-                        Mix_ResumeMusic();
-                    } else {
-                        Mix_PauseMusic();
-                    }
-                    break;
-                default:
-                    break;
+    SurfacePtr target{resources.track(SDL_CreateRGBSurfaceWithFormat(
+        0, config.width, config.height, 32, SDL_PIXELFORMAT_ARGB8888))};
+    if (!target) {
+        auto error = std::format("Error creating Surface: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+
+    TextLayout log{fonts, 16, config.width - 16, Align::Left};
+    std::size_t visible =
+        static_cast<std::size_t>(config.height / log.line_height());
+    std::mt19937 gen{12345};
+    std::uniform_int_distribution<std::size_t> pick_word{0, words.size() - 1};
+    std::uniform_int_distribution<int> pick_length{2, 40};
+    std::vector<float> frame_times;
+    std::string lines;
+
+    int written = 0;
+    int scrolled = 0;
+    std::size_t top = 0;
+    while (written < total_lines || scrolled < scroll_frames) {
+        auto start = std::chrono::steady_clock::now();
+        if (written < total_lines) {
+            // Every fourth line repeats, as log lines tend to.
+            lines.clear();
+            for (int i = 0; i < lines_per_frame; i++, written++) {
+                if (written > 0) {
+                    lines += '\n';
+                }
+                if (written % 4 == 0) {
+                    lines += "bounce sound played";
+                    continue;
+                }
+                lines += std::format("[{:05}]", written);
+                for (int n = pick_length(gen); n > 0; n--) {
+                    lines += ' ';
+                    lines += words[pick_word(gen)];
                 }
-            default:
-                break;
             }
+            log.append(lines);
+            top = log.lines().size() - std::min(log.lines().size(), visible);
+        } else {
+            top -= std::min(top, visible / 2);
+            scrolled++;
         }
 
-        this->update_text();
-        this->update_sprite();
+        SDL_FillRect(target.get(), nullptr, 0);
+        log.draw(target.get(), 8, 0, top, visible, {255, 255, 255, 255});
+        frame_times.push_back(
+            Ms{std::chrono::steady_clock::now() - start}.count());
+    }
 
-        SDL_RenderClear(this->renderer.get());
+    std::size_t hits = log.break_hits();
+    std::size_t misses = log.break_misses();
+    auto start = std::chrono::steady_clock::now();
+    log.set_width(config.width / 2);
+    Ms narrow_time = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    log.set_width(config.width - 16);
+    Ms restore_time = std::chrono::steady_clock::now() - start;
 
-        SDL_RenderCopy(this->renderer.get(), this->background.get(), nullptr,
-                       nullptr);
+    std::sort(frame_times.begin(), frame_times.end());
+    std::size_t n = frame_times.size();
+    float p99 = frame_times[n * 99 / 100];
+    std::cout << std::format(
+        "Log of {} lines in {} wrapped lines over {} frames: p50 {:.3f} "
+        "p99 {:.3f} max {:.3f} ms\n",
+        written, log.lines().size(), n, frame_times[n / 2], p99,
+        frame_times.back());
+    std::cout << std::format(
+        "Line breaks while appending: {} cached {} laid out\n", hits, misses);
+    std::cout << std::format(
+        "Rewrap at half width {:.2f} ms, back again {:.2f} ms "
+        "({} cached)\n",
+        narrow_time.count(), restore_time.count(), log.break_hits() - hits);
+    fonts.report();
+
+    return p99 < 1000.0f / 60.0f ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-        SDL_RenderCopy(this->renderer.get(), this->text.get(), nullptr,
-                       &this->text_rect);
-        SDL_RenderCopy(this->renderer.get(), this->sprite.get(), nullptr,
-                       &this->sprite_rect);
+// Mixes a second of noise from up to 512 voices scattered around a
+// listener, without an audio device, and reports the cost of each voice.
+// Fails if the full set takes more than a quarter of the time the audio
+// it produces lasts.
+int bench_mixer(const Config &config) {
+    constexpr int channels{MIX_DEFAULT_CHANNELS};
+    constexpr int frequency{MIX_DEFAULT_FREQUENCY};
+    constexpr std::size_t buffer_frames{1024};
+    constexpr int buffers{200};
+    constexpr std::array<int, 5> voice_counts{1, 32, 128, 256, 512};
+    using Us = std::chrono::duration<double, std::micro>;
 
-        SDL_RenderPresent(this->renderer.get());
+    std::mt19937 gen{12345};
+    std::uniform_int_distribution<int> noise{-8000, 8000};
+    std::vector<Sint16> samples(static_cast<std::size_t>(frequency) *
+                                channels * 10);
+    for (Sint16 &sample : samples) {
+        sample = static_cast<Sint16>(noise(gen));
+    }
+    Mix_Chunk chunk{0, reinterpret_cast<Uint8 *>(samples.data()),
+                    static_cast<Uint32>(samples.size() * sizeof(Sint16)),
+                    MIX_MAX_VOLUME};
+
+    auto width = static_cast<float>(config.width);
+    auto height = static_cast<float>(config.height);
+    std::uniform_real_distribution<float> pick_x{0.0f, width};
+    std::uniform_real_distribution<float> pick_y{0.0f, height};
+    SDL_FPoint listener{width / 2.0f, height / 2.0f};
+    std::vector<Sint16> out(buffer_frames * channels);
+    double buffer_us = 1e6 * buffer_frames / frequency;
+    double last_share = 0.0;
+
+    for (int voices : voice_counts) {
+        SoundMixer mixer;
+        for (int v = 0; v < voices; v++) {
+            mixer.play(&chunk, spatialize({pick_x(gen), pick_y(gen)},
+                                          listener, width, height));
+        }
+        mixer.mix(out.data(), 0);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int b = 0; b < buffers; b++) {
+            std::fill(out.begin(), out.end(), Sint16{0});
+            mixer.mix(out.data(), buffer_frames);
+        }
+        Us per_buffer = (std::chrono::steady_clock::now() - start) / buffers;
+        last_share = per_buffer.count() / buffer_us;
 
-        SDL_Delay(16);
+        std::cout << std::format(
+            "{:4} voices: {:8.1f} us per {}-frame buffer, {:6.3f} us per "
+            "voice, {:5.1f}% of real time ({} playing)\n",
+            voices, per_buffer.count(), buffer_frames,
+            per_buffer.count() / voices, 100.0 * last_share, mixer.playing());
     }
+
+    return last_share < 0.25 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-void initialize_sdl() {
-    int sdl_flags = SDL_INIT_EVERYTHING;
-    int img_flags = IMG_INIT_PNG;
-    int mix_flags = MIX_INIT_OGG;
+// Drives the input map from an SDL virtual game controller, so the
+// controller path runs without any hardware. Checks that each bound button
+// and stick direction reaches its action, then times ticks and checks that
+// they do not allocate.
+int bench_input() {
+    using JoystickPtr = Handle<SDL_Joystick, SDL_JoystickClose>;
 
-    if (SDL_Init(sdl_flags)) {
-        auto error = std::format("Error initialize SDL2: {}", SDL_GetError());
+    struct Case {
+        const char *name;
+        int button;
+        int axis;
+        Sint16 value;
+        Action action;
+    };
+    constexpr std::array<Case, 11> cases{{
+        {"button A", SDL_CONTROLLER_BUTTON_A, -1, 0, Action::Flash},
+        {"button Y", SDL_CONTROLLER_BUTTON_Y, -1, 0, Action::ToggleMusic},
+        {"button back", SDL_CONTROLLER_BUTTON_BACK, -1, 0, Action::Quit},
+        {"d-pad left", SDL_CONTROLLER_BUTTON_DPAD_LEFT, -1, 0, Action::Left},
+        {"d-pad right", SDL_CONTROLLER_BUTTON_DPAD_RIGHT, -1, 0,
+         Action::Right},
+        {"d-pad up", SDL_CONTROLLER_BUTTON_DPAD_UP, -1, 0, Action::Up},
+        {"d-pad down", SDL_CONTROLLER_BUTTON_DPAD_DOWN, -1, 0, Action::Down},
+        {"stick left", -1, SDL_CONTROLLER_AXIS_LEFTX, -32768, Action::Left},
+        {"stick right", -1, SDL_CONTROLLER_AXIS_LEFTX, 32767, Action::Right},
+        {"stick up", -1, SDL_CONTROLLER_AXIS_LEFTY, -32768, Action::Up},
+        {"stick down", -1, SDL_CONTROLLER_AXIS_LEFTY, 32767, Action::Down},
+    }};
+    constexpr int ticks = 100000;
+
+    require_sdl_gamecontroller();
+    int device = SDL_JoystickAttachVirtual(SDL_JOYSTICK_TYPE_GAMECONTROLLER,
+                                           SDL_CONTROLLER_AXIS_MAX,
+                                           SDL_CONTROLLER_BUTTON_MAX, 0);
+    if (device < 0) {
+        auto error = std::format("Error attaching virtual controller: {}",
+                                 SDL_GetError());
         throw std::runtime_error(error);
     }
-
-    if ((IMG_Init(img_flags) & img_flags) != img_flags) {
-        auto error =
-            std::format("Error initialize SDL_image: {}", IMG_GetError());
+    JoystickPtr joystick{SDL_JoystickOpen(device)};
+    if (!joystick) {
+        auto error = std::format("Error opening Joystick: {}", SDL_GetError());
         throw std::runtime_error(error);
     }
 
-    if (TTF_Init()) {
-        auto error =
-            std::format("Error initialize SDL_ttf: {}", TTF_GetError());
+    InputMap input;
+    SDL_Event event;
+    auto tick = [&input, &event]() {
+        while (SDL_PollEvent(&event)) {
+            input.handle(event);
+        }
+        input.update();
+    };
+    auto set = [&joystick](const Case &c, bool on) {
+        if (c.button >= 0) {
+            SDL_JoystickSetVirtualButton(joystick.get(), c.button,
+                                         on ? SDL_PRESSED : SDL_RELEASED);
+        } else {
+            SDL_JoystickSetVirtualAxis(joystick.get(), c.axis,
+                                       on ? c.value : 0);
+        }
+    };
+
+    tick();
+    bool ok = input.controllers() == 1;
+    std::cout << std::format("Virtual controller {}\n",
+                             ok ? "opened" : "NOT OPENED");
+
+    for (const auto &c : cases) {
+        set(c, true);
+        tick();
+        bool down = input.held(c.action) && input.pressed(c.action);
+        set(c, false);
+        tick();
+        bool up = !input.held(c.action);
+        std::cout << std::format("{:<12} {}\n", c.name,
+                                 down && up ? "ok" : "FAILED");
+        ok = ok && down && up;
+    }
+
+    std::size_t before = heap_allocation_count.load();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ticks; i++) {
+        set(cases[0], i % 2 == 0);
+        tick();
+    }
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::size_t allocations = heap_allocation_count.load() - before;
+    std::cout << std::format("{:.2f} us/tick, {} heap allocations\n",
+                             elapsed.count() / ticks, allocations);
+
+    joystick.reset();
+    SDL_JoystickDetachVirtual(device);
+
+    return ok && allocations == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Runs the frame loop of both pacing modes against a simulated 60 Hz
+// display, where presenting blocks until the next vsync. Each frame
+// busy-waits 3 to 5 ms of work, and eight key presses spread evenly over
+// every gap between polls are timed from arrival to present. Prints the
+// latency histogram of each mode and fails unless low-latency pacing has
+// the lower median.
+int bench_pacing(const Config &config) {
+    using Clock = FramePacer::Clock;
+    using Ms = FramePacer::Ms;
+    constexpr double refresh_ms = 1000.0 / 60.0;
+    constexpr int frames = 150;
+    constexpr int warmup = 10;
+    constexpr int presses = 8;
+
+    Uint32 frame_delay = 1000 / std::max(1, config.tick_rate);
+    auto origin = Clock::now();
+    auto ms_at = [origin](auto t) {
+        return static_cast<Uint32>(Ms{t - origin}.count());
+    };
+    auto next_vsync = [origin](Clock::time_point t) {
+        double vsyncs = std::ceil(Ms{t - origin}.count() / refresh_ms);
+        return origin + std::chrono::duration_cast<Clock::duration>(
+                            Ms{vsyncs * refresh_ms});
+    };
+
+    auto run = [&](bool low_latency) {
+        FramePacer pacer{low_latency, refresh_ms, frame_delay};
+        InputLatency latency;
+        auto last_poll = Clock::now();
+        for (int frame = 0; frame < frames; frame++) {
+            pacer.wait_to_poll();
+            auto poll = Clock::now();
+            if (frame >= warmup) {
+                for (int i = 0; i < presses; i++) {
+                    latency.key_down(
+                        ms_at(last_poll + (poll - last_poll) * (i + 0.5) /
+                                              presses));
+                }
+            }
+            last_poll = poll;
+
+            auto work = Ms{3.0 + (frame % 5) * 0.5};
+            while (Clock::now() - poll < work) {
+            }
+            pacer.work_done(poll, Clock::now());
+
+            std::this_thread::sleep_until(next_vsync(Clock::now()));
+            auto shown = Clock::now();
+            latency.presented(ms_at(shown));
+            pacer.presented(shown);
+            pacer.wait_after_frame();
+        }
+
+        std::cout << std::format("{} pacing (work estimate {:.1f} ms):\n",
+                                 low_latency ? "Low-latency" : "Normal",
+                                 pacer.work_ms());
+        latency.report(60);
+        return latency.median();
+    };
+
+    Uint32 normal = run(false);
+    Uint32 low = run(true);
+    std::cout << std::format("Median input to present {} ms -> {} ms {}\n",
+                             normal, low, low < normal ? "ok" : "NO GAIN");
+    return low < normal ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Decoded assets shared read-only by every session in server mode.
+struct SharedAssets {
+    SurfacePtr background;
+    SurfacePtr icon;
+    SurfacePtr text;
+    TileMap tile_map;
+};
+
+SharedAssets load_shared_assets(const Config &config) {
+    SharedAssets assets{nullptr, nullptr, nullptr, {}};
+
+    require_sdl_image();
+    assets.background.reset(
+        resources.track(IMG_Load("images/background.png")));
+    assets.icon.reset(resources.track(IMG_Load("images/Cpp-logo.png")));
+    if (!assets.background || !assets.icon) {
+        auto error = std::format("Error loading Surface: {}", IMG_GetError());
         throw std::runtime_error(error);
     }
 
-    if ((Mix_Init(mix_flags) & mix_flags) != mix_flags) {
-        auto error =
-            std::format("Error initialize SDL_mixer: {}", Mix_GetError());
+    require_sdl_ttf();
+    std::ifstream font_file{"fonts/freesansbold.ttf", std::ios::binary};
+    FontManager fonts{static_cast<std::size_t>(config.font_budget) * 1024};
+    if (!fonts.load({std::istreambuf_iterator<char>{font_file},
+                     std::istreambuf_iterator<char>{}},
+                    config.font_size)) {
+        auto error = std::format("Error creating Font: {}", TTF_GetError());
         throw std::runtime_error(error);
     }
+    assets.text = fonts.render(config.font_size, "SDL", {255, 255, 255, 255});
 
-    if (Mix_OpenAudio(MIX_DEFAULT_FREQUENCY, MIX_DEFAULT_FORMAT,
-                      MIX_DEFAULT_CHANNELS, 1024)) {
-        auto error = std::format("Error Opening Audio: {}", Mix_GetError());
+    int tile_size = std::max(1, config.tile_size);
+    assets.tile_map.resize(config.map_tiles_x(), config.map_tiles_y(),
+                           tile_size, assets.background->w,
+                           assets.background->h);
+
+    return assets;
+}
+
+// One game hosted in server mode. A scripted player chases the text with
+// the sprite. With rendering on, each session draws into its own surface
+// through SDL's software renderer, with textures made from the shared
+// surfaces. Textures are made in the constructor because converting a
+// surface is not thread-safe, while tick() may run on any thread.
+class ServerSession {
+  public:
+    ServerSession(const Config &config, const SharedAssets &assets,
+                  unsigned seed);
+
+    void tick();
+
+  private:
+    void render();
+
+    const SharedAssets &assets;
+    Simulation sim;
+    Camera camera;
+    SurfacePtr target;
+    RendererPtr renderer;
+    TexturePtr background;
+    TexturePtr text;
+    TexturePtr sprite;
+};
+
+ServerSession::ServerSession(const Config &config, const SharedAssets &assets,
+                             unsigned seed)
+    : assets{assets}, sim{config}, camera{0, 0, config.width, config.height},
+      target{nullptr}, renderer{nullptr}, background{nullptr}, text{nullptr},
+      sprite{nullptr} {
+    this->sim.rng().seed(seed);
+    this->sim.set_text_size(assets.text->w, assets.text->h);
+    this->sim.set_sprite_size(assets.icon->w, assets.icon->h);
+
+    if (!config.server_render) {
+        return;
+    }
+
+    this->target.reset(resources.track(SDL_CreateRGBSurfaceWithFormat(
+        0, config.width, config.height, 32, SDL_PIXELFORMAT_ARGB8888)));
+    if (!this->target) {
+        auto error = std::format("Error creating Surface: {}", SDL_GetError());
+        throw std::runtime_error(error);
+    }
+    this->renderer.reset(SDL_CreateSoftwareRenderer(this->target.get()));
+    if (!this->renderer) {
+        auto error = std::format("Error creating Renderer: {}", SDL_GetError());
         throw std::runtime_error(error);
     }
+
+    auto upload = [this](SDL_Surface *surf) {
+        TexturePtr texture{resources.track(
+            SDL_CreateTextureFromSurface(this->renderer.get(), surf))};
+        if (!texture) {
+            auto error =
+                std::format("Error creating Texture: {}", SDL_GetError());
+            throw std::runtime_error(error);
+        }
+        return texture;
+    };
+    this->background = upload(assets.background.get());
+    this->text = upload(assets.text.get());
+    this->sprite = upload(assets.icon.get());
 }
 
-void close_sdl() {
-    Mix_CloseAudio();
-    Mix_Quit();
-    TTF_Quit();
-    IMG_Quit();
-    SDL_Quit();
+void ServerSession::tick() {
+    const SDL_Rect &text = this->sim.text_rect();
+    const SDL_Rect &sprite = this->sim.sprite_rect();
+    int dx = (text.x + text.w / 2) - (sprite.x + sprite.w / 2);
+    int dy = (text.y + text.h / 2) - (sprite.y + sprite.h / 2);
+
+    Simulation::Input input{static_cast<float>((dx > 0) - (dx < 0)),
+                            static_cast<float>((dy > 0) - (dy < 0))};
+    this->sim.step(input, {255, 255, 255, 255});
+
+    if (this->renderer) {
+        this->render();
+    }
 }
 
-int main() {
+void ServerSession::render() {
+    SDL_Renderer *renderer = this->renderer.get();
+    SDL_RenderClear(renderer);
+
+    const TileMap &tile_map = this->assets.tile_map;
+    this->camera.follow(this->sim.sprite_rect(), tile_map.world_w(),
+                        tile_map.world_h());
+    tile_map.for_each_visible(
+        this->camera, [this, renderer](const SDL_Rect &src,
+                                       const SDL_Rect &dst) {
+            SDL_RenderCopy(renderer, this->background.get(), &src, &dst);
+        });
+
+    SDL_Rect text_screen = this->camera.to_screen(this->sim.text_rect());
+    SDL_Rect sprite_screen = this->camera.to_screen(this->sim.sprite_rect());
+    SDL_RenderCopy(renderer, this->text.get(), nullptr, &text_screen);
+    SDL_RenderCopy(renderer, this->sprite.get(), nullptr, &sprite_screen);
+    this->sim.particles().draw(renderer, this->camera);
+    SDL_RenderPresent(renderer);
+}
+
+// Hosts --sessions games (one per core by default) in this process for
+// --frames ticks each, with the decoded assets loaded once and shared.
+// Sessions run uncapped across the thread pool. The report gives the
+// memory and setup cost per session and how many real-time sessions each
+// core could carry.
+int run_server(const Config &config) {
+    using Clock = std::chrono::steady_clock;
+    using Ms = std::chrono::duration<double, std::milli>;
+
+    int frames = config.frames > 0 ? config.frames : 600;
+    ThreadPool pool;
+    pool.start(config.thread_count());
+    int session_count = config.sessions > 0 ? config.sessions
+                                            : static_cast<int>(pool.size());
+
+    auto load_start = Clock::now();
+    SharedAssets assets = load_shared_assets(config);
+    Ms load_time = Clock::now() - load_start;
+    std::size_t shared_bytes = resources.total_bytes();
+
+    std::size_t rss_before = current_rss_kb();
+    auto setup_start = Clock::now();
+    std::vector<ServerSession> sessions;
+    sessions.reserve(static_cast<std::size_t>(session_count));
+    std::random_device seeds;
+    for (int i = 0; i < session_count; i++) {
+        sessions.emplace_back(config, assets, seeds());
+    }
+    Ms setup_time = Clock::now() - setup_start;
+    std::size_t rss_sessions = current_rss_kb() - rss_before;
+
+    auto run_start = Clock::now();
+    pool.parallel_for(session_count, [&sessions, frames](int i) {
+        for (int frame = 0; frame < frames; frame++) {
+            sessions[static_cast<std::size_t>(i)].tick();
+        }
+    });
+    Ms run_time = Clock::now() - run_start;
+
+    double ticks = static_cast<double>(session_count) * frames;
+    double ticks_per_s = ticks / (run_time.count() / 1000.0);
+    double realtime = ticks_per_s / std::max(1, config.tick_rate);
+    std::cout << std::format(
+        "Server {} sessions x {} ticks on {} threads, rendering {}\n",
+        session_count, frames, pool.size(),
+        config.server_render ? "on" : "off");
+    std::cout << std::format(
+        "Shared assets {:.1f} KiB loaded once in {:.2f} ms\n",
+        shared_bytes / 1024.0, load_time.count());
+    std::cout << std::format(
+        "Per session setup {:.3f} ms resident {:.1f} KiB\n",
+        setup_time.count() / session_count,
+        static_cast<double>(rss_sessions) / session_count);
+    std::cout << std::format(
+        "{:.0f} ticks/s, {:.1f} real-time sessions, {:.1f} per core\n",
+        ticks_per_s, realtime, realtime / pool.size());
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
     int exit_val = EXIT_SUCCESS;
 
     try {
-        initialize_sdl();
-        Game game;
-        game.init();
-        game.load_media();
-        game.run();
+        Config config = load_config(argc, argv);
+        if (config.bench_kernels) {
+            exit_val = bench_kernels();
+        } else if (config.bench_particles) {
+            exit_val = bench_particles(config);
+        } else if (config.bench_sweep) {
+            exit_val = bench_sweep(config);
+        } else if (config.bench_snapshot) {
+            exit_val = bench_snapshot(config);
+        } else if (config.bench_motion) {
+            exit_val = bench_motion(config);
+        } else if (config.bench_map) {
+            exit_val = bench_map(config);
+        } else if (config.bench_text) {
+            exit_val = bench_text(config);
+        } else if (config.bench_mixer) {
+            exit_val = bench_mixer(config);
+        } else if (config.bench_input) {
+            exit_val = bench_input();
+        } else if (config.bench_pacing) {
+            exit_val = bench_pacing(config);
+        } else if (config.server) {
+            // Sessions never open a window or audio device, so neither
+            // subsystem is started.
+            exit_val = run_server(config);
+        } else {
+            initialize_sdl();
+            startup_timer.mark("initialize_sdl");
+            if (config.bench_streaming) {
+                bench_streaming(config);
+            } else if (config.bench_render_queue) {
+                bench_render_queue(config);
+            } else {
+                Game game{config};
+                game.init();
+                startup_timer.mark("init");
+                game.load_media();
+                startup_timer.mark("load_media");
+                game.run();
+                exit_val = game.report();
+            }
+        }
     } catch (const std::runtime_error &e) {
         std::cerr << e.what() << std::endl;
         exit_val = EXIT_FAILURE;